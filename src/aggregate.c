@@ -0,0 +1,148 @@
+/**
+ * Contains all functionality for the scalar aggregates (sum, avg, min, max
+ * and count) over columns and value vectors.
+ *
+ * The input is split into morsels that run on the thread pool. Each morsel
+ * folds its values into a partial of its own, with a 64 bit sum so that
+ * sums over hundreds of millions of rows do not overflow, and the partials
+ * are merged once every morsel is done. The partials sit in one array,
+ * padded to a cache line each, so workers never write to the same line.
+ **/
+
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <limits.h>
+
+#include "aggregate.h"
+#include "arith_kernel.h"
+#include "utils.h"
+
+/**
+ * AggregateJob
+ * An aggregate on the thread pool: partials holds one entry per morsel.
+ **/
+typedef struct AggregateJob {
+    const int* values;
+    const uint64_t* valid;
+    AggregatePartial* partials;
+} AggregateJob;
+
+void aggregate_partial_init(AggregatePartial* partial) {
+    partial->sum = 0;
+    partial->count = 0;
+    partial->min = INT_MAX;
+    partial->max = INT_MIN;
+}
+
+/**
+ * Fold n values into partial. The loops are branch free, so the compiler
+ * vectorizes them.
+ **/
+void aggregate_partial_add(AggregatePartial* partial, const int* values, int n) {
+    long long sum = 0;
+    int low = partial->min;
+    int high = partial->max;
+    for (int i = 0; i < n; i++) {
+        sum += values[i];
+    }
+    for (int i = 0; i < n; i++) {
+        low = values[i] < low ? values[i] : low;
+        high = values[i] > high ? values[i] : high;
+    }
+    partial->sum += sum;
+    partial->count += n;
+    partial->min = low;
+    partial->max = high;
+}
+
+/**
+ * Fold the values of n that are not null in valid into partial. Runs of 64
+ * without a null go through aggregate_partial_add.
+ **/
+static void aggregate_partial_add_valid(AggregatePartial* partial, const int* values,
+                                        const uint64_t* valid, int n) {
+    for (int start = 0; start < n; start += 64) {
+        int len = n - start < 64 ? n - start : 64;
+        uint64_t bits = valid[start / 64];
+        if (len == 64 && bits == ~0ULL) {
+            aggregate_partial_add(partial, values + start, len);
+            continue;
+        }
+        for (int i = 0; i < len; i++) {
+            if ((bits >> i) & 1) {
+                aggregate_partial_add(partial, values + start + i, 1);
+            }
+        }
+    }
+}
+
+void aggregate_partial_merge(AggregatePartial* into, const AggregatePartial* from) {
+    into->sum += from->sum;
+    into->count += from->count;
+    into->min = from->min < into->min ? from->min : into->min;
+    into->max = from->max > into->max ? from->max : into->max;
+}
+
+/**
+ * Stores the final value of an aggregate of type over partial in entry.
+ * Only the average is a double; it is NaN over no values. Min and max of
+ * no values are INT_MAX and INT_MIN.
+ **/
+void aggregate_partial_store(const AggregatePartial* partial, AggregateType type, CatalogEntry* entry) {
+    entry->has_value = true;
+    entry->is_int = type != AGG_AVG;
+    switch (type) {
+        case AGG_SUM: entry->int_value = partial->sum; break;
+        case AGG_AVG: entry->value = (double) partial->sum / partial->count; break;
+        case AGG_MIN: entry->int_value = partial->min; break;
+        case AGG_MAX: entry->int_value = partial->max; break;
+        case AGG_COUNT: entry->int_value = partial->count; break;
+    }
+}
+
+static void aggregate_morsel(void* arg, int start, int end) {
+    AggregateJob* job = (AggregateJob*) arg;
+    AggregatePartial* partial = &job->partials[start / MORSEL_SIZE];
+    aggregate_partial_init(partial);
+    if (job->valid == NULL) {
+        aggregate_partial_add(partial, job->values + start, end - start);
+    } else {
+        // morsels start on multiples of 64, so on a word of valid
+        aggregate_partial_add_valid(partial, job->values + start, job->valid + start / 64, end - start);
+    }
+}
+
+/**
+ * Sum, count, min and max of the n values, stored in *total. Values whose
+ * bit in valid is clear are null and left out; valid may be NULL.
+ * Returns -1 if the partials could not be allocated.
+ **/
+int aggregate_values(const int* values, const uint64_t* valid, int n, AggregatePartial* total) {
+    aggregate_partial_init(total);
+    if (arith_count_nulls(valid, n) == 0) {
+        valid = NULL;
+    }
+    int num_morsels = (n + MORSEL_SIZE - 1) / MORSEL_SIZE;
+    if (num_morsels <= 1) {
+        AggregateJob job = { values, valid, total };
+        aggregate_morsel(&job, 0, n);
+        return 0;
+    }
+
+    AggregateJob job;
+    job.values = values;
+    job.valid = valid;
+    void* partials = NULL;
+    if (posix_memalign(&partials, sizeof(AggregatePartial), num_morsels * sizeof(AggregatePartial)) != 0) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    job.partials = partials;
+    thread_pool_run(aggregate_morsel, &job, 0, n, MORSEL_SIZE);
+    for (int i = 0; i < num_morsels; i++) {
+        aggregate_partial_merge(total, &job.partials[i]);
+    }
+    free(job.partials);
+    return 0;
+}
@@ -0,0 +1,324 @@
+/**
+ * Contains the vectorized arithmetic kernels.
+ *
+ * Evaluates add, sub, mul and div of two int32 operands over a vector of
+ * rows, where either operand may be a scalar that is broadcast to every row.
+ * Add, sub and mul wrap around like the two's complement hardware does. A
+ * row whose division is undefined (by zero, or INT_MIN by -1) is null: its
+ * bit in the caller's validity mask is cleared rather than the row carrying
+ * a sentinel value, so the kernels never branch on the data. Division goes
+ * through doubles, which hold every int32 quotient exactly, so that it can
+ * use the SIMD divide. As for the select kernels, the widest set the CPU
+ * supports (AVX2, SSE2 or plain C) is picked once through CPUID.
+ **/
+
+#include <limits.h>
+
+#include "arith_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ARITH_KERNEL_X86 1
+#endif
+
+typedef void (*BinaryKernel)(const int* left, const int* right, int n, int* out);
+typedef void (*DivideKernel)(const int* left, const int* right, int n, int* out, uint64_t* valid);
+
+/**
+ * ArithKernels
+ * One kernel per operator, all for the same instruction set.
+ **/
+typedef struct ArithKernels {
+    BinaryKernel add;
+    BinaryKernel sub;
+    BinaryKernel mul;
+    DivideKernel div;
+    const char* name;
+} ArithKernels;
+
+static const ArithKernels* kernels = NULL;
+
+
+/**
+ * Rows [from, n) of each operator, for the scalar kernels and the tails of
+ * the SIMD ones. Unsigned arithmetic keeps overflow defined.
+ **/
+static void add_range(const int* left, const int* right, int from, int n, int* out) {
+    for (int i = from; i < n; i++) {
+        out[i] = (int) ((unsigned) left[i] + (unsigned) right[i]);
+    }
+}
+
+static void sub_range(const int* left, const int* right, int from, int n, int* out) {
+    for (int i = from; i < n; i++) {
+        out[i] = (int) ((unsigned) left[i] - (unsigned) right[i]);
+    }
+}
+
+static void mul_range(const int* left, const int* right, int from, int n, int* out) {
+    for (int i = from; i < n; i++) {
+        out[i] = (int) ((unsigned) left[i] * (unsigned) right[i]);
+    }
+}
+
+static void div_range(const int* left, const int* right, int from, int n, int* out, uint64_t* valid) {
+    for (int i = from; i < n; i++) {
+        int null = (right[i] == 0) | ((left[i] == INT_MIN) & (right[i] == -1));
+        int divisor = null ? 1 : right[i];
+        out[i] = null ? 0 : left[i] / divisor;
+        valid[i / 64] &= ~((uint64_t) null << (i % 64));
+    }
+}
+
+static void add_scalar(const int* left, const int* right, int n, int* out) {
+    add_range(left, right, 0, n, out);
+}
+
+static void sub_scalar(const int* left, const int* right, int n, int* out) {
+    sub_range(left, right, 0, n, out);
+}
+
+static void mul_scalar(const int* left, const int* right, int n, int* out) {
+    mul_range(left, right, 0, n, out);
+}
+
+static void div_scalar(const int* left, const int* right, int n, int* out, uint64_t* valid) {
+    div_range(left, right, 0, n, out, valid);
+}
+
+static const ArithKernels scalar_kernels = { add_scalar, sub_scalar, mul_scalar, div_scalar, "scalar" };
+
+#ifdef ARITH_KERNEL_X86
+
+__attribute__((target("sse2")))
+static void add_sse2(const int* left, const int* right, int n, int* out) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (left + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (right + i));
+        _mm_storeu_si128((__m128i*) (out + i), _mm_add_epi32(a, b));
+    }
+    add_range(left, right, i, n, out);
+}
+
+__attribute__((target("sse2")))
+static void sub_sse2(const int* left, const int* right, int n, int* out) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (left + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (right + i));
+        _mm_storeu_si128((__m128i*) (out + i), _mm_sub_epi32(a, b));
+    }
+    sub_range(left, right, i, n, out);
+}
+
+__attribute__((target("sse2")))
+static void mul_sse2(const int* left, const int* right, int n, int* out) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (left + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (right + i));
+        // SSE2 only multiplies the even lanes: do odd lanes shifted down
+        // and interleave the low halves of the products
+        __m128i even = _mm_mul_epu32(a, b);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+        __m128i lo = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, 0x08), _mm_shuffle_epi32(odd, 0x08));
+        _mm_storeu_si128((__m128i*) (out + i), lo);
+    }
+    mul_range(left, right, i, n, out);
+}
+
+__attribute__((target("sse2")))
+static void div_sse2(const int* left, const int* right, int n, int* out, uint64_t* valid) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi32(1);
+    __m128i minus_one = _mm_set1_epi32(-1);
+    __m128i min = _mm_set1_epi32(INT_MIN);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (left + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (right + i));
+        __m128i null = _mm_or_si128(_mm_cmpeq_epi32(b, zero),
+                _mm_and_si128(_mm_cmpeq_epi32(a, min), _mm_cmpeq_epi32(b, minus_one)));
+        b = _mm_or_si128(_mm_and_si128(null, one), _mm_andnot_si128(null, b));
+        __m128i lo = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(a), _mm_cvtepi32_pd(b)));
+        __m128i hi = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(a, 0xEE)),
+                _mm_cvtepi32_pd(_mm_shuffle_epi32(b, 0xEE))));
+        __m128i q = _mm_andnot_si128(null, _mm_unpacklo_epi64(lo, hi));
+        _mm_storeu_si128((__m128i*) (out + i), q);
+        uint64_t bits = (unsigned) _mm_movemask_ps(_mm_castsi128_ps(null));
+        valid[i / 64] &= ~(bits << (i % 64));
+    }
+    div_range(left, right, i, n, out, valid);
+}
+
+static const ArithKernels sse2_kernels = { add_sse2, sub_sse2, mul_sse2, div_sse2, "sse2" };
+
+__attribute__((target("avx2")))
+static void add_avx2(const int* left, const int* right, int n, int* out) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (left + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (right + i));
+        _mm256_storeu_si256((__m256i*) (out + i), _mm256_add_epi32(a, b));
+    }
+    add_range(left, right, i, n, out);
+}
+
+__attribute__((target("avx2")))
+static void sub_avx2(const int* left, const int* right, int n, int* out) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (left + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (right + i));
+        _mm256_storeu_si256((__m256i*) (out + i), _mm256_sub_epi32(a, b));
+    }
+    sub_range(left, right, i, n, out);
+}
+
+__attribute__((target("avx2")))
+static void mul_avx2(const int* left, const int* right, int n, int* out) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (left + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (right + i));
+        _mm256_storeu_si256((__m256i*) (out + i), _mm256_mullo_epi32(a, b));
+    }
+    mul_range(left, right, i, n, out);
+}
+
+__attribute__((target("avx2")))
+static void div_avx2(const int* left, const int* right, int n, int* out, uint64_t* valid) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i one = _mm256_set1_epi32(1);
+    __m256i minus_one = _mm256_set1_epi32(-1);
+    __m256i min = _mm256_set1_epi32(INT_MIN);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (left + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (right + i));
+        __m256i null = _mm256_or_si256(_mm256_cmpeq_epi32(b, zero),
+                _mm256_and_si256(_mm256_cmpeq_epi32(a, min), _mm256_cmpeq_epi32(b, minus_one)));
+        b = _mm256_blendv_epi8(b, one, null);
+        __m128i lo = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(a)),
+                _mm256_cvtepi32_pd(_mm256_castsi256_si128(b))));
+        __m128i hi = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(a, 1)),
+                _mm256_cvtepi32_pd(_mm256_extracti128_si256(b, 1))));
+        __m256i q = _mm256_andnot_si256(null, _mm256_set_m128i(hi, lo));
+        _mm256_storeu_si256((__m256i*) (out + i), q);
+        uint64_t bits = (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(null));
+        valid[i / 64] &= ~(bits << (i % 64));
+    }
+    div_range(left, right, i, n, out, valid);
+}
+
+static const ArithKernels avx2_kernels = { add_avx2, sub_avx2, mul_avx2, div_avx2, "avx2" };
+
+#endif
+
+/**
+ * Pick the widest kernels this CPU supports. Racing threads all pick the
+ * same ones, so no locking is needed.
+ **/
+static void choose_kernels(void) {
+    const ArithKernels* chosen = &scalar_kernels;
+#ifdef ARITH_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        chosen = &avx2_kernels;
+    } else if (__builtin_cpu_supports("sse2")) {
+        chosen = &sse2_kernels;
+    }
+#endif
+    kernels = chosen;
+}
+
+/**
+ * Name of the kernels in use ("avx2", "sse2" or "scalar").
+ **/
+const char* arith_kernel_name(void) {
+    if (kernels == NULL) {
+        choose_kernels();
+    }
+    return kernels->name;
+}
+
+/**
+ * Writes left op right for n rows to out. An operand whose values are NULL
+ * is its scalar instead, the same for every row. For div, the bit of every
+ * row whose quotient is undefined is cleared in valid (n bits, the caller
+ * sets them); the row itself gets 0. The other operators leave valid alone.
+ **/
+void arith_apply(ArithmeticType type, const int* left, int left_scalar,
+                 const int* right, int right_scalar, int n, int* out, uint64_t* valid) {
+    if (kernels == NULL) {
+        choose_kernels();
+    }
+    int left_broadcast[ARITH_CHUNK];
+    int right_broadcast[ARITH_CHUNK];
+    if (left == NULL) {
+        for (int i = 0; i < ARITH_CHUNK; i++) {
+            left_broadcast[i] = left_scalar;
+        }
+    }
+    if (right == NULL) {
+        for (int i = 0; i < ARITH_CHUNK; i++) {
+            right_broadcast[i] = right_scalar;
+        }
+    }
+
+    // chunks start on multiples of 64, so each starts its own word of valid
+    for (int start = 0; start < n; start += ARITH_CHUNK) {
+        int len = n - start < ARITH_CHUNK ? n - start : ARITH_CHUNK;
+        const int* a = left != NULL ? left + start : left_broadcast;
+        const int* b = right != NULL ? right + start : right_broadcast;
+        switch (type) {
+            case ARITH_ADD: kernels->add(a, b, len, out + start); break;
+            case ARITH_SUB: kernels->sub(a, b, len, out + start); break;
+            case ARITH_MUL: kernels->mul(a, b, len, out + start); break;
+            case ARITH_DIV: kernels->div(a, b, len, out + start, valid + start / 64); break;
+        }
+    }
+}
+
+/**
+ * True if value i of a vector is null. valid may be NULL, for a vector
+ * without nulls.
+ **/
+bool arith_is_null(const uint64_t* valid, int i) {
+    return valid != NULL && !((valid[i / 64] >> (i % 64)) & 1);
+}
+
+/**
+ * Number of the first n bits of valid that are clear (null values).
+ **/
+int arith_count_nulls(const uint64_t* valid, int n) {
+    if (valid == NULL) {
+        return 0;
+    }
+    int words = (n + 63) / 64;
+    int nulls = 0;
+    for (int w = 0; w < words; w++) {
+        uint64_t bits = w == n / 64 ? valid[w] | (~0ULL << (n % 64)) : valid[w];
+        nulls += __builtin_popcountll(~bits);
+    }
+    return nulls;
+}
+
+/**
+ * Drops the values of a vector whose bit in valid is clear (null), keeping
+ * the order of the rest. Returns how many are left. Only for vectors that
+ * nothing else lines up with, such as the input of an aggregate.
+ **/
+int arith_drop_nulls(int* values, int n, const uint64_t* valid) {
+    if (arith_count_nulls(valid, n) == 0) {
+        return n;
+    }
+    // always store, only advance past the stored slot for a valid value
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        values[count] = values[i];
+        count += (valid[i / 64] >> (i % 64)) & 1;
+    }
+    return count;
+}
@@ -0,0 +1,225 @@
+/**
+ * Contains all functionality for running the queued commands of an async
+ * batch concurrently.
+ *
+ * Every queued command ("handle=query") writes the handles left of its
+ * '=' and reads the names in its argument list. A command depends on each
+ * earlier command that writes a name it reads or writes, or that reads a
+ * name it writes. Commands are put in waves by the longest chain of
+ * dependencies before them; the commands of a wave cannot depend on each
+ * other, so they run at the same time on the worker pool, one command per
+ * morsel, and a wave only starts once the one before it is done.
+ **/
+
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "async_batch.h"
+#include "db_operator.h"
+#include "parse.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+/**
+ * AsyncCommand
+ * A queued command with the names it writes and reads, which point into
+ * names (a tokenized copy of the command), and the status it ran with.
+ **/
+typedef struct AsyncCommand {
+    char* command;
+    char* names;
+    char** writes;
+    int num_writes;
+    char** reads;
+    int num_reads;
+    int wave;
+    message_status status;
+} AsyncCommand;
+
+/**
+ * AsyncWave
+ * One wave on the thread pool: members lists the commands it runs.
+ **/
+typedef struct AsyncWave {
+    AsyncCommand* commands;
+    int* members;
+    int client_socket;
+    ClientContext* context;
+    CatalogHashtable* variable_pool;
+    Queue* batch_queue;
+} AsyncWave;
+
+/**
+ * Splits text in place at every character of separators and stores the
+ * non-empty pieces in names. Returns their number.
+ **/
+static int split_names(char* text, const char* separators, char** names) {
+    int n = 0;
+    char* token;
+    while ((token = strsep(&text, separators)) != NULL) {
+        if (*token != '\0') {
+            names[n++] = token;
+        }
+    }
+    return n;
+}
+
+/**
+ * Finds the names command writes and reads.
+ **/
+static int async_command_init(AsyncCommand* cmd, char* command) {
+    memset(cmd, 0, sizeof(AsyncCommand));
+    cmd->command = command;
+    size_t len = strlen(command);
+    cmd->names = malloc(len + 1);
+    // no more names than characters
+    cmd->writes = malloc((len + 1) * sizeof(char*));
+    cmd->reads = malloc((len + 1) * sizeof(char*));
+    if (!cmd->names || !cmd->writes || !cmd->reads) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    memcpy(cmd->names, command, len + 1);
+    char* equals = strchr(cmd->names, '=');
+    if (equals == NULL) {
+        return 0;
+    }
+    *equals = '\0';
+    cmd->num_writes = split_names(cmd->names, ", ", cmd->writes);
+    char* args = strchr(equals + 1, '(');
+    if (args != NULL) {
+        cmd->num_reads = split_names(args + 1, ",() ", cmd->reads);
+    }
+    return 0;
+}
+
+static void async_command_free(AsyncCommand* cmd) {
+    free(cmd->names);
+    free(cmd->writes);
+    free(cmd->reads);
+}
+
+static bool names_meet(char** a, int num_a, char** b, int num_b) {
+    for (int i = 0; i < num_a; i++) {
+        for (int j = 0; j < num_b; j++) {
+            if (strcmp(a[i], b[j]) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Whether later has to wait for earlier.
+ **/
+static bool depends_on(const AsyncCommand* later, const AsyncCommand* earlier) {
+    return names_meet(earlier->writes, earlier->num_writes, later->reads, later->num_reads)
+        || names_meet(earlier->writes, earlier->num_writes, later->writes, later->num_writes)
+        || names_meet(earlier->reads, earlier->num_reads, later->writes, later->num_writes);
+}
+
+static void async_command_morsel(void* arg, int start, int end) {
+    AsyncWave* wave = (AsyncWave*) arg;
+    for (int i = start; i < end; i++) {
+        AsyncCommand* cmd = &wave->commands[wave->members[i]];
+        message send_message;
+        memset(&send_message, 0, sizeof(message));
+        parse_command(cmd->command, &send_message, wave->client_socket, wave->context,
+                wave->variable_pool, wave->batch_queue);
+        cmd->status = send_message.status;
+    }
+}
+
+/**
+ * A handle read by several commands of a wave is run first if it has only
+ * been planned: running a plan fills in its entry, which the readers must
+ * not do at the same time.
+ **/
+static void materialize_shared_reads(AsyncCommand* commands, int* members, int num_members,
+                                     CatalogHashtable* variable_pool) {
+    for (int m = 0; m < num_members; m++) {
+        AsyncCommand* cmd = &commands[members[m]];
+        for (int r = 0; r < cmd->num_reads; r++) {
+            bool shared = false;
+            for (int o = m + 1; o < num_members && !shared; o++) {
+                AsyncCommand* other = &commands[members[o]];
+                shared = names_meet(&cmd->reads[r], 1, other->reads, other->num_reads);
+            }
+            if (shared) {
+                CatalogEntry* entry = get(variable_pool, cmd->reads[r]);
+                if (entry != NULL && entry->plan != NULL) {
+                    materialize_result(entry);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Runs commands[0, num_commands) (NULL slots are skipped) wave by wave on
+ * the worker pool. Their strings are consumed but not freed. status is set
+ * to the error of the first command, in batch order, that failed, and left
+ * alone if none did. Returns -1, before running anything, if the graph
+ * cannot be built.
+ **/
+int async_batch_run(char** commands, int num_commands, int client_socket, ClientContext* context,
+                    CatalogHashtable* variable_pool, Queue* batch_queue, message_status* status) {
+    AsyncCommand* graph = calloc(num_commands > 0 ? num_commands : 1, sizeof(AsyncCommand));
+    int* members = malloc((num_commands > 0 ? num_commands : 1) * sizeof(int));
+    if (!graph || !members) {
+        perror("Memory allocation failed");
+        free(graph);
+        free(members);
+        return -1;
+    }
+    int n = 0;
+    int ret = 0;
+    for (int i = 0; i < num_commands && ret == 0; i++) {
+        if (commands[i] != NULL) {
+            ret = async_command_init(&graph[n], commands[i]);
+            n++;
+        }
+    }
+
+    // a command's wave is one past the latest wave it depends on
+    int num_waves = 0;
+    for (int k = 0; k < n && ret == 0; k++) {
+        for (int j = 0; j < k; j++) {
+            if (graph[j].wave >= graph[k].wave && depends_on(&graph[k], &graph[j])) {
+                graph[k].wave = graph[j].wave + 1;
+            }
+        }
+        if (graph[k].wave + 1 > num_waves) {
+            num_waves = graph[k].wave + 1;
+        }
+    }
+
+    for (int w = 0; w < num_waves && ret == 0; w++) {
+        int num_members = 0;
+        for (int k = 0; k < n; k++) {
+            if (graph[k].wave == w) {
+                members[num_members++] = k;
+            }
+        }
+        materialize_shared_reads(graph, members, num_members, variable_pool);
+        AsyncWave wave = { graph, members, client_socket, context, variable_pool, batch_queue };
+        thread_pool_run(async_command_morsel, &wave, 0, num_members, 1);
+        // entries the wave replaced may have been looked up by its other commands
+        release_retired(variable_pool);
+    }
+
+    bool failed = false;
+    for (int k = 0; k < n; k++) {
+        if (ret == 0 && !failed && graph[k].status != OK_DONE && graph[k].status != OK_WAIT_FOR_RESPONSE) {
+            *status = graph[k].status;
+            failed = true;
+        }
+        async_command_free(&graph[k]);
+    }
+    free(graph);
+    free(members);
+    return ret;
+}
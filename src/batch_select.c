@@ -0,0 +1,349 @@
+/**
+ * Contains all functionality for evaluating a batch of range selects on one
+ * column in a single shared scan.
+ *
+ * The column is cut into BATCH_TILE row tiles and every predicate of the
+ * batch is evaluated on a tile before moving on, so the tile is read from
+ * memory once however many selects there are. Each select gets a bitmap of
+ * its own; tiles start on multiples of 64 rows, so they fill whole words.
+ *
+ * A small batch runs the SIMD range kernel of every predicate over the
+ * tile. A large batch would make that cost grow with the number of
+ * predicates, so it is turned around: the distinct bounds of all ranges
+ * are sorted, which cuts the value domain into elementary intervals, and
+ * every interval lists the predicates that cover it. A value then costs one
+ * branch-free binary search for its interval plus one bit per predicate it
+ * actually matches, i.e. O(log Q) instead of O(Q) for Q selective ranges.
+ *
+ * Fetches of a batch that read the same column are gathered the same way,
+ * all of them advancing through a tile before the next one is touched.
+ *
+ * When the column has a sorted or B+tree index, the batch does not scan at
+ * all: the same sorted bounds are located in the index's value order and
+ * the qualifying stretch of the index is walked once for every predicate.
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch_select.h"
+#include "positions.h"
+#include "select_kernel.h"
+#include "utils.h"
+
+/**
+ * SortedBounds
+ * The batch's ranges as elementary intervals: a value v lies in interval
+ * rank(v), the number of bounds <= v, and matches the predicates
+ * cover[cover_offsets[rank] .. cover_offsets[rank + 1]).
+ **/
+typedef struct SortedBounds {
+    int* bounds;
+    int num_bounds;
+    int* cover_offsets;
+    int* cover;
+} SortedBounds;
+
+/**
+ * BatchJob
+ * A batch on the thread pool; sorted is NULL when every predicate runs the
+ * range kernel.
+ **/
+typedef struct BatchJob {
+    const int* values;
+    SelectObject** selects;
+    int num_selects;
+    uint64_t** bitmaps;
+    const SortedBounds* sorted;
+} BatchJob;
+
+
+static int compare_ints(const void* a, const void* b) {
+    int x = *(const int*) a;
+    int y = *(const int*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Number of bounds (sorted, n > 0) that are <= v, without branching on
+ * the comparisons.
+ **/
+static inline int bound_rank(const int* bounds, int n, int v) {
+    const int* base = bounds;
+    int len = n;
+    while (len > 1) {
+        int half = len / 2;
+        base = base[half - 1] <= v ? base + half : base;
+        len -= half;
+    }
+    return (int) (base - bounds) + (*base <= v);
+}
+
+static void free_sorted_bounds(SortedBounds* sorted) {
+    free(sorted->bounds);
+    free(sorted->cover_offsets);
+    free(sorted->cover);
+}
+
+/**
+ * Builds the elementary intervals of the batch. Returns -1 if they would
+ * list more than BATCH_MAX_COVER predicates, or on allocation failure.
+ **/
+static int build_sorted_bounds(SelectObject** selects, int num_selects, SortedBounds* sorted) {
+    memset(sorted, 0, sizeof(SortedBounds));
+    sorted->bounds = malloc(2 * num_selects * sizeof(int));
+    if (!sorted->bounds) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    int n = 0;
+    for (int i = 0; i < num_selects; i++) {
+        if (selects[i]->minval < selects[i]->maxval) {
+            sorted->bounds[n++] = selects[i]->minval;
+            sorted->bounds[n++] = selects[i]->maxval;
+        }
+    }
+    qsort(sorted->bounds, n, sizeof(int), compare_ints);
+    int distinct = 0;
+    for (int i = 0; i < n; i++) {
+        if (distinct == 0 || sorted->bounds[distinct - 1] != sorted->bounds[i]) {
+            sorted->bounds[distinct++] = sorted->bounds[i];
+        }
+    }
+    sorted->num_bounds = distinct;
+    if (distinct == 0) {
+        // no predicate can match anything
+        sorted->cover_offsets = calloc(2, sizeof(int));
+        return sorted->cover_offsets ? 0 : -1;
+    }
+
+    // [lo, hi) covers the intervals rank(lo) .. rank(hi) - 1
+    long long total = 0;
+    for (int i = 0; i < num_selects; i++) {
+        if (selects[i]->minval < selects[i]->maxval) {
+            total += bound_rank(sorted->bounds, distinct, selects[i]->maxval)
+                   - bound_rank(sorted->bounds, distinct, selects[i]->minval);
+        }
+    }
+    if (total > BATCH_MAX_COVER) {
+        free_sorted_bounds(sorted);
+        return -1;
+    }
+    sorted->cover_offsets = calloc(distinct + 2, sizeof(int));
+    sorted->cover = malloc((total > 0 ? total : 1) * sizeof(int));
+    if (!sorted->cover_offsets || !sorted->cover) {
+        perror("Memory allocation failed");
+        free_sorted_bounds(sorted);
+        return -1;
+    }
+    for (int i = 0; i < num_selects; i++) {
+        if (selects[i]->minval < selects[i]->maxval) {
+            int first = bound_rank(sorted->bounds, distinct, selects[i]->minval);
+            int last = bound_rank(sorted->bounds, distinct, selects[i]->maxval);
+            for (int k = first; k < last; k++) {
+                sorted->cover_offsets[k + 1]++;
+            }
+        }
+    }
+    for (int k = 0; k <= distinct; k++) {
+        sorted->cover_offsets[k + 1] += sorted->cover_offsets[k];
+    }
+    int* fill = malloc((distinct + 1) * sizeof(int));
+    if (!fill) {
+        perror("Memory allocation failed");
+        free_sorted_bounds(sorted);
+        return -1;
+    }
+    memcpy(fill, sorted->cover_offsets, (distinct + 1) * sizeof(int));
+    for (int i = 0; i < num_selects; i++) {
+        if (selects[i]->minval < selects[i]->maxval) {
+            int first = bound_rank(sorted->bounds, distinct, selects[i]->minval);
+            int last = bound_rank(sorted->bounds, distinct, selects[i]->maxval);
+            for (int k = first; k < last; k++) {
+                sorted->cover[fill[k]++] = i;
+            }
+        }
+    }
+    free(fill);
+    return 0;
+}
+
+/**
+ * Rows [start, end) of a tile through the sorted bounds: each value sets
+ * the bit of exactly the predicates it matches.
+ **/
+static void tile_sorted(const BatchJob* job, int start, int end) {
+    const SortedBounds* sorted = job->sorted;
+    if (sorted->num_bounds == 0) {
+        return;
+    }
+    const int* offsets = sorted->cover_offsets;
+    for (int row = start; row < end; row++) {
+        int k = bound_rank(sorted->bounds, sorted->num_bounds, job->values[row]);
+        uint64_t bit = 1ULL << (row % 64);
+        for (int c = offsets[k]; c < offsets[k + 1]; c++) {
+            job->bitmaps[sorted->cover[c]][row / 64] |= bit;
+        }
+    }
+}
+
+/**
+ * Rows [start, end) of a tile through the range kernel of every predicate.
+ **/
+static void tile_kernel(const BatchJob* job, int start, int end) {
+    for (int i = 0; i < job->num_selects; i++) {
+        SelectObject* select = job->selects[i];
+        select_range_bitmap(job->values + start, end - start, select->minval, select->maxval,
+                job->bitmaps[i] + start / 64);
+    }
+}
+
+static void batch_select_morsel(void* arg, int start, int end) {
+    BatchJob* job = (BatchJob*) arg;
+    for (int tile = start; tile < end; tile += BATCH_TILE) {
+        int tile_end = tile + BATCH_TILE < end ? tile + BATCH_TILE : end;
+        if (job->sorted != NULL) {
+            tile_sorted(job, tile, tile_end);
+        } else {
+            tile_kernel(job, tile, tile_end);
+        }
+    }
+}
+
+/**
+ * Sets bit r of bitmaps[i] (zeroed, num_rows bits each) iff values[r] is in
+ * the range of selects[i], for every select of the batch in one pass over
+ * values. parallel runs the pass on the worker pool.
+ **/
+void batch_select_bitmaps(const int* values, int num_rows, SelectObject** selects, int num_selects,
+                          uint64_t** bitmaps, bool parallel) {
+    BatchJob job = { values, selects, num_selects, bitmaps, NULL };
+    SortedBounds sorted;
+    if (num_selects >= BATCH_SORTED_MIN_PREDICATES
+            && build_sorted_bounds(selects, num_selects, &sorted) == 0) {
+        job.sorted = &sorted;
+    }
+    if (parallel) {
+        thread_pool_run(batch_select_morsel, &job, 0, num_rows, MORSEL_SIZE);
+    } else {
+        batch_select_morsel(&job, 0, num_rows);
+    }
+    if (job.sorted != NULL) {
+        free_sorted_bounds(&sorted);
+    }
+}
+
+/**
+ * Gathers the values of every batched fetch from one column in one pass:
+ * results[i] gets values[p] for each row p of positions[i] (ascending
+ * position results) that is below num_rows, and counts[i] their number.
+ * The fetches advance together a tile at a time, so each tile of the
+ * column is read once for all of them.
+ **/
+void batch_gather(const int* values, int num_rows, CatalogEntry** positions, int num_fetches,
+                  int** results, int* counts) {
+    PositionCursor* cursors = malloc((num_fetches > 0 ? num_fetches : 1) * sizeof(PositionCursor));
+    int* pending = malloc((num_fetches > 0 ? num_fetches : 1) * sizeof(int));
+    if (!cursors || !pending) {
+        perror("Memory allocation failed");
+        free(cursors);
+        free(pending);
+        for (int i = 0; i < num_fetches; i++) {
+            counts[i] = 0;
+        }
+        return;
+    }
+    for (int i = 0; i < num_fetches; i++) {
+        position_cursor_init(&cursors[i], positions[i]);
+        pending[i] = position_cursor_next(&cursors[i]);
+        counts[i] = 0;
+    }
+    for (int tile = 0; tile < num_rows; tile += BATCH_TILE) {
+        int tile_end = tile + BATCH_TILE < num_rows ? tile + BATCH_TILE : num_rows;
+        for (int i = 0; i < num_fetches; i++) {
+            int pos = pending[i];
+            int* out = results[i];
+            int n = counts[i];
+            while (pos != -1 && pos < tile_end) {
+                out[n++] = values[pos];
+                pos = position_cursor_next(&cursors[i]);
+            }
+            pending[i] = pos;
+            counts[i] = n;
+        }
+    }
+    free(cursors);
+    free(pending);
+}
+
+/**
+ * First of values[from, count) (ascending) that is >= v, found by
+ * galloping out from from and then bisecting the last step.
+ **/
+static int gallop_lower_bound(const int* values, int from, int count, int v) {
+    int low = from;
+    int high = from;
+    int step = 1;
+    while (high < count && values[high] < v) {
+        low = high + 1;
+        high += step;
+        step *= 2;
+    }
+    if (high > count) {
+        high = count;
+    }
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (values[mid] < v) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * Sets bit r of bitmaps[i] (zeroed, count bits each) iff row r is in the
+ * range of selects[i], from a sorted or B+tree index of the column: its
+ * values in ascending order and the row each came from. The distinct
+ * bounds of the batch are resolved in one merged search over values, each
+ * starting where the last one ended, and the index is then walked once,
+ * every entry setting the bits of the predicates that cover its interval.
+ **/
+void batch_select_index(const int* values, const int* positions, int count, SelectObject** selects,
+                        int num_selects, uint64_t** bitmaps) {
+    SortedBounds sorted;
+    if (build_sorted_bounds(selects, num_selects, &sorted) != 0) {
+        // too many overlapping ranges to list: walk each range on its own
+        for (int i = 0; i < num_selects; i++) {
+            if (selects[i]->minval >= selects[i]->maxval) {
+                continue;
+            }
+            int first = gallop_lower_bound(values, 0, count, selects[i]->minval);
+            int last = gallop_lower_bound(values, first, count, selects[i]->maxval);
+            for (int k = first; k < last; k++) {
+                bitmaps[i][positions[k] / 64] |= 1ULL << (positions[k] % 64);
+            }
+        }
+        return;
+    }
+
+    // entries [start, end) hold the values of interval r
+    const int* offsets = sorted.cover_offsets;
+    int start = 0;
+    for (int r = 0; r <= sorted.num_bounds && start < count; r++) {
+        int end = r < sorted.num_bounds ? gallop_lower_bound(values, start, count, sorted.bounds[r]) : count;
+        if (offsets[r] < offsets[r + 1]) {
+            for (int k = start; k < end; k++) {
+                int row = positions[k];
+                uint64_t bit = 1ULL << (row % 64);
+                for (int c = offsets[r]; c < offsets[r + 1]; c++) {
+                    bitmaps[sorted.cover[c]][row / 64] |= bit;
+                }
+            }
+        }
+        start = end;
+    }
+    free_sorted_bounds(&sorted);
+}
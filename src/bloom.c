@@ -0,0 +1,106 @@
+/**
+ * Contains all functionality for Bloom filters.
+ *
+ * A Bloom filter built from the keys of a join's build side lets the scans
+ * of the other side drop rows that cannot have a match before their
+ * positions are ever materialized or fetched, so a selective dimension
+ * predicate also prunes the fact side.
+ *
+ * The filter is split into blocks of BLOOM_BLOCK_WORDS words. A key picks
+ * one block and sets one bit in each of its words, so adding or testing a
+ * key touches a single cache line instead of one per hash function.
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom.h"
+#include "utils.h"
+
+// odd constants that pick a key's bit in each word of its block
+static const uint32_t bloom_salt[BLOOM_BLOCK_WORDS] = {
+    0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+    0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u
+};
+
+static inline uint64_t bloom_hash(int key) {
+    uint64_t h = (uint32_t) key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * Filter sized for num_keys keys, with a power of two number of blocks.
+ **/
+BloomFilter* bloom_create(int num_keys) {
+    BloomFilter* bloom = malloc(sizeof(BloomFilter));
+    if (!bloom) {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+    long long bits = (long long) (num_keys > 0 ? num_keys : 1) * BLOOM_BITS_PER_KEY;
+    int num_blocks = 1;
+    while ((long long) num_blocks * BLOOM_BLOCK_WORDS * 32 < bits) {
+        num_blocks <<= 1;
+    }
+    bloom->num_blocks = num_blocks;
+    bloom->blocks = calloc((size_t) num_blocks * BLOOM_BLOCK_WORDS, sizeof(uint32_t));
+    if (!bloom->blocks) {
+        perror("Memory allocation failed");
+        free(bloom);
+        return NULL;
+    }
+    return bloom;
+}
+
+void bloom_add(BloomFilter* bloom, int key) {
+    uint64_t h = bloom_hash(key);
+    uint32_t* block = bloom->blocks + (size_t) ((h >> 32) & (bloom->num_blocks - 1)) * BLOOM_BLOCK_WORDS;
+    for (int w = 0; w < BLOOM_BLOCK_WORDS; w++) {
+        block[w] |= 1u << (((uint32_t) h * bloom_salt[w]) >> 27);
+    }
+}
+
+/**
+ * False if key was certainly never added; true if it probably was.
+ **/
+bool bloom_may_contain(const BloomFilter* bloom, int key) {
+    uint64_t h = bloom_hash(key);
+    const uint32_t* block = bloom->blocks + (size_t) ((h >> 32) & (bloom->num_blocks - 1)) * BLOOM_BLOCK_WORDS;
+    uint32_t missing = 0;
+    for (int w = 0; w < BLOOM_BLOCK_WORDS; w++) {
+        missing |= ~block[w] & (1u << (((uint32_t) h * bloom_salt[w]) >> 27));
+    }
+    return missing == 0;
+}
+
+/**
+ * Clears the bits of bitmap (bit i for values[i]) whose value is not in
+ * bloom. Only rows that are still set are tested.
+ **/
+void bloom_filter_bitmap(const BloomFilter* bloom, const int* values, int n, uint64_t* bitmap) {
+    int words = (n + 63) / 64;
+    for (int w = 0; w < words; w++) {
+        uint64_t bits = bitmap[w];
+        uint64_t keep = bits;
+        while (bits) {
+            int bit = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (!bloom_may_contain(bloom, values[w * 64 + bit])) {
+                keep &= ~(1ULL << bit);
+            }
+        }
+        bitmap[w] = keep;
+    }
+}
+
+void bloom_free(BloomFilter* bloom) {
+    if (bloom != NULL) {
+        free(bloom->blocks);
+        free(bloom);
+    }
+}
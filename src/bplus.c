@@ -142,8 +142,11 @@ void* load_bptree(FILE* fd, int* base_data) {
     t->connect_children = NULL;
     t->num_children = 0;
 
-    // recursively load children
-    load_bptree_node(fd, root, t, base_data);
+    // recursively load children; a root that is a leaf has none, and its
+    // positions came in with the node itself
+    if (!root->is_leaf) {
+        load_bptree_node(fd, root, t, base_data);
+    }
 
     // connect leaves
     BPTreeNode* last = NULL;
@@ -337,6 +340,17 @@ BPTreeNode* find_leaf_node(BPTreeNode* root, int val) {
     return curr;
 }
 
+/**
+ * Leftmost leaf, where the leaf chain in value order starts.
+ **/
+BPTreeNode* first_leaf(BPTreeNode* root) {
+    BPTreeNode* curr = root;
+    while (curr != NULL && !curr->is_leaf) {
+        curr = curr->type.internal_node.pointers[0];
+    }
+    return curr;
+}
+
 
 /**
  * Creates a new empty BPlusNode.
@@ -0,0 +1,533 @@
+/**
+ * Contains all functionality for the binary column files.
+ *
+ * Every column keeps a packed int32 copy of its values next to the text file
+ * so that scans can run straight over an mmap of the file instead of
+ * re-parsing text with fgets + atoi on every query. The file starts with a
+ * fixed 64 byte ColumnHeader (row count, min, max, sortedness) that is kept
+ * current on every write, so readers can size the column and answer min/max
+ * or out-of-range questions without touching the values. While a column is
+ * open for writing the file is grown in doubling steps, and it is trimmed back
+ * down to exactly count values when it is synced.
+ *
+ * Next to the values every column also keeps a zone map (col.zmp): the min and
+ * max of each ZONE_SIZE block of rows. It is updated together with the values
+ * so that selects can skip or accept whole blocks by looking at two ints.
+ **/
+
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "column_file.h"
+#include "utils.h"
+
+
+/**
+ * Given the path of a column ("./db/tbl/col" or "./db/tbl/col.txt")
+ * return the path of its binary file ("./db/tbl/col.bin").
+ **/
+char* column_bin_path(const char* col_path) {
+    size_t len = strlen(col_path);
+    if (len > 4 && strcmp(col_path + len - 4, ".txt") == 0) {
+        len -= 4;
+    }
+
+    char* bin_path = malloc(len + 5);
+    if (!bin_path) {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+    memcpy(bin_path, col_path, len);
+    strcpy(bin_path + len, ".bin");
+    return bin_path;
+}
+
+static size_t file_size_for(size_t capacity) {
+    return sizeof(ColumnHeader) + capacity * sizeof(int);
+}
+
+/**
+ * Number of zones needed to cover capacity values (always at least one so
+ * the zone file can be mapped).
+ **/
+static size_t zones_for(size_t capacity) {
+    return capacity / ZONE_SIZE + 1;
+}
+
+/**
+ * Given the path of a binary column file ("./db/tbl/col.bin") return the
+ * path of its zone map file ("./db/tbl/col.zmp").
+ **/
+static char* zone_path(const char* bin_path) {
+    size_t len = strlen(bin_path);
+    if (len > 4 && strcmp(bin_path + len - 4, ".bin") == 0) {
+        len -= 4;
+    }
+
+    char* path = malloc(len + 5);
+    if (!path) {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+    memcpy(path, bin_path, len);
+    strcpy(path + len, ".zmp");
+    return path;
+}
+
+static int map_zones(ColumnFile* cf) {
+    if (cf->zone_fd == -1 || cf->zone_capacity == 0) {
+        cf->zones = NULL;
+        return 0;
+    }
+    int prot = cf->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* base = mmap(NULL, cf->zone_capacity * sizeof(ColumnZone), prot, MAP_SHARED, cf->zone_fd, 0);
+    if (base == MAP_FAILED) {
+        perror("Error mapping zone map");
+        cf->zones = NULL;
+        return -1;
+    }
+    cf->zones = (ColumnZone*) base;
+    return 0;
+}
+
+static void unmap_zones(ColumnFile* cf) {
+    if (cf->zones != NULL) {
+        munmap(cf->zones, cf->zone_capacity * sizeof(ColumnZone));
+        cf->zones = NULL;
+    }
+}
+
+/**
+ * Resize the zone file so it covers the current capacity of cf and map it.
+ **/
+static int resize_zones(ColumnFile* cf) {
+    unmap_zones(cf);
+    cf->zone_capacity = zones_for(cf->capacity);
+    if (ftruncate(cf->zone_fd, cf->zone_capacity * sizeof(ColumnZone)) == -1) {
+        perror("Error extending zone map");
+        return -1;
+    }
+    return map_zones(cf);
+}
+
+/**
+ * Recompute the zones from zone first up to the end of the column.
+ **/
+static void rebuild_zones(ColumnFile* cf, size_t first) {
+    if (cf->zones == NULL) {
+        return;
+    }
+    for (size_t z = first; z * ZONE_SIZE < cf->count; z++) {
+        size_t start = z * ZONE_SIZE;
+        size_t end = start + ZONE_SIZE < cf->count ? start + ZONE_SIZE : cf->count;
+        int min = cf->values[start];
+        int max = cf->values[start];
+        for (size_t i = start + 1; i < end; i++) {
+            if (cf->values[i] < min) {
+                min = cf->values[i];
+            }
+            if (cf->values[i] > max) {
+                max = cf->values[i];
+            }
+        }
+        cf->zones[z].min = min;
+        cf->zones[z].max = max;
+    }
+}
+
+/**
+ * Open (creating it if asked) the zone map next to cf. A reader that finds
+ * no zone map simply gets cf->zones == NULL and scans every block.
+ **/
+static int open_zones(ColumnFile* cf, bool create) {
+    cf->zone_fd = -1;
+    cf->zones = NULL;
+    cf->zone_capacity = 0;
+    if (cf->header->zone_size != ZONE_SIZE) {
+        if (!cf->writable) {
+            return 0;
+        }
+        create = true;
+    }
+
+    char* path = zone_path(cf->path);
+    if (!path) {
+        return -1;
+    }
+    int flags = cf->writable ? O_RDWR : O_RDONLY;
+    if (create) {
+        flags |= O_CREAT | O_TRUNC;
+    }
+    cf->zone_fd = open(path, flags, S_IRUSR | S_IWUSR);
+    if (cf->zone_fd == -1 && cf->writable && !create) {
+        create = true;
+        cf->zone_fd = open(path, flags | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    }
+    free(path);
+    if (cf->zone_fd == -1) {
+        if (cf->writable) {
+            perror("Error opening zone map");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (cf->writable) {
+        if (resize_zones(cf) == -1) {
+            return -1;
+        }
+        if (create) {
+            cf->header->zone_size = ZONE_SIZE;
+            rebuild_zones(cf, 0);
+        }
+        return 0;
+    }
+
+    // the writer always grows the zone file before writing to it, so only
+    // trust as many zones as the file actually holds
+    struct stat sb;
+    if (fstat(cf->zone_fd, &sb) == -1) {
+        perror("fstat");
+        return -1;
+    }
+    cf->zone_capacity = sb.st_size / sizeof(ColumnZone);
+    return map_zones(cf);
+}
+
+/**
+ * Number of leading zones of cf that can be trusted for its rows.
+ **/
+size_t column_file_zone_count(const ColumnFile* cf) {
+    if (cf == NULL || cf->zones == NULL) {
+        return 0;
+    }
+    size_t needed = (cf->count + ZONE_SIZE - 1) / ZONE_SIZE;
+    return needed < cf->zone_capacity ? needed : cf->zone_capacity;
+}
+
+static void close_zones(ColumnFile* cf) {
+    unmap_zones(cf);
+    if (cf->zone_fd != -1) {
+        close(cf->zone_fd);
+        cf->zone_fd = -1;
+    }
+}
+
+/**
+ * Map the header and capacity values of the file behind cf.
+ * Assumes the file is already at least that large.
+ **/
+static int map_values(ColumnFile* cf) {
+    int prot = cf->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* base = mmap(NULL, file_size_for(cf->capacity), prot, MAP_SHARED, cf->fd, 0);
+    if (base == MAP_FAILED) {
+        perror("Error mapping column file");
+        cf->header = NULL;
+        cf->values = NULL;
+        return -1;
+    }
+    cf->header = (ColumnHeader*) base;
+    cf->values = (int*) ((char*) base + sizeof(ColumnHeader));
+    return 0;
+}
+
+static void unmap_values(ColumnFile* cf) {
+    if (cf->header != NULL) {
+        munmap(cf->header, file_size_for(cf->capacity));
+        cf->header = NULL;
+        cf->values = NULL;
+    }
+}
+
+/**
+ * Read just the header of the binary file for the column at col_path.
+ * Returns -1 if there is no binary file or it is not in a format we know.
+ **/
+int column_file_read_header(const char* col_path, ColumnHeader* header) {
+    char* bin_path = column_bin_path(col_path);
+    if (!bin_path) {
+        return -1;
+    }
+    int fd = open(bin_path, O_RDONLY);
+    free(bin_path);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t n = pread(fd, header, sizeof(ColumnHeader), 0);
+    close(fd);
+    if (n != (ssize_t) sizeof(ColumnHeader) || header->magic != COLUMN_FILE_MAGIC
+            || header->version != COLUMN_FILE_VERSION) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Create (or truncate) the binary file for the column at col_path and map it
+ * for writing with room for COLUMN_FILE_START_CAPACITY values.
+ **/
+ColumnFile* column_file_create(const char* col_path) {
+    char* bin_path = column_bin_path(col_path);
+    if (!bin_path) {
+        return NULL;
+    }
+
+    ColumnFile* cf = calloc(1, sizeof(ColumnFile));
+    if (!cf) {
+        perror("Memory allocation failed");
+        free(bin_path);
+        return NULL;
+    }
+    strncpy(cf->path, bin_path, MAX_SIZE_NAME - 1);
+    free(bin_path);
+
+    cf->fd = open(cf->path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (cf->fd == -1) {
+        perror("Error opening column file");
+        free(cf);
+        return NULL;
+    }
+
+    cf->writable = true;
+    cf->count = 0;
+    cf->capacity = COLUMN_FILE_START_CAPACITY;
+    if (ftruncate(cf->fd, file_size_for(cf->capacity)) == -1) {
+        perror("Error extending column file");
+        close(cf->fd);
+        free(cf);
+        return NULL;
+    }
+    if (map_values(cf) == -1) {
+        close(cf->fd);
+        free(cf);
+        return NULL;
+    }
+
+    memset(cf->header, 0, sizeof(ColumnHeader));
+    cf->header->magic = COLUMN_FILE_MAGIC;
+    cf->header->version = COLUMN_FILE_VERSION;
+    cf->header->row_count = 0;
+    cf->header->min = INT_MAX;
+    cf->header->max = INT_MIN;
+    cf->header->sorted = 1;
+    cf->header->zone_size = ZONE_SIZE;
+    if (open_zones(cf, true) == -1) {
+        close_zones(cf);
+        unmap_values(cf);
+        close(cf->fd);
+        free(cf);
+        return NULL;
+    }
+    return cf;
+}
+
+/**
+ * Map an existing binary column file. Returns NULL if the column has no
+ * binary file (e.g. it was only ever written as text) or the file was
+ * written in a format we do not understand.
+ **/
+ColumnFile* column_file_open(const char* col_path, bool writable) {
+    ColumnHeader header;
+    if (column_file_read_header(col_path, &header) == -1) {
+        return NULL;
+    }
+
+    char* bin_path = column_bin_path(col_path);
+    if (!bin_path) {
+        return NULL;
+    }
+    int fd = open(bin_path, writable ? O_RDWR : O_RDONLY);
+    if (fd == -1) {
+        free(bin_path);
+        return NULL;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1) {
+        perror("fstat");
+        close(fd);
+        free(bin_path);
+        return NULL;
+    }
+
+    ColumnFile* cf = calloc(1, sizeof(ColumnFile));
+    if (!cf) {
+        perror("Memory allocation failed");
+        close(fd);
+        free(bin_path);
+        return NULL;
+    }
+    strncpy(cf->path, bin_path, MAX_SIZE_NAME - 1);
+    free(bin_path);
+
+    cf->fd = fd;
+    cf->writable = writable;
+    cf->count = header.row_count;
+    cf->capacity = (sb.st_size - sizeof(ColumnHeader)) / sizeof(int);
+    if (cf->capacity < cf->count) {
+        log_err("Column file %s is shorter than its header says\n", cf->path);
+        close(fd);
+        free(cf);
+        return NULL;
+    }
+    if (writable && cf->capacity < COLUMN_FILE_START_CAPACITY) {
+        cf->capacity = COLUMN_FILE_START_CAPACITY;
+        if (ftruncate(fd, file_size_for(cf->capacity)) == -1) {
+            perror("Error extending column file");
+            close(fd);
+            free(cf);
+            return NULL;
+        }
+    }
+    if (map_values(cf) == -1) {
+        close(fd);
+        free(cf);
+        return NULL;
+    }
+    if (open_zones(cf, false) == -1) {
+        close_zones(cf);
+        unmap_values(cf);
+        close(fd);
+        free(cf);
+        return NULL;
+    }
+    return cf;
+}
+
+/**
+ * Double the capacity of a writable column file (and its zone map) and remap it.
+ **/
+static int grow(ColumnFile* cf) {
+    size_t capacity = cf->capacity ? cf->capacity * 2 : COLUMN_FILE_START_CAPACITY;
+    if (ftruncate(cf->fd, file_size_for(capacity)) == -1) {
+        perror("Error extending column file");
+        return -1;
+    }
+    // map the larger file before dropping the old mapping, so that on
+    // failure cf still describes a mapping it can write to
+    void* base = mmap(NULL, file_size_for(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, cf->fd, 0);
+    if (base == MAP_FAILED) {
+        perror("Error mapping column file");
+        return -1;
+    }
+    unmap_values(cf);
+    cf->capacity = capacity;
+    cf->header = (ColumnHeader*) base;
+    cf->values = (int*) ((char*) base + sizeof(ColumnHeader));
+    return resize_zones(cf);
+}
+
+/**
+ * Fold a newly written value into the header's min/max.
+ **/
+static void update_bounds(ColumnHeader* header, int val) {
+    if (val < header->min) {
+        header->min = val;
+    }
+    if (val > header->max) {
+        header->max = val;
+    }
+}
+
+int column_file_append(ColumnFile* cf, int val) {
+    if (cf == NULL || !cf->writable) {
+        return -1;
+    }
+    if (cf->count == cf->capacity && grow(cf) == -1) {
+        return -1;
+    }
+    if (cf->count > 0 && cf->values[cf->count - 1] > val) {
+        cf->header->sorted = 0;
+    }
+    if (cf->zones != NULL) {
+        ColumnZone* zone = &cf->zones[cf->count / ZONE_SIZE];
+        if (cf->count % ZONE_SIZE == 0) {
+            zone->min = val;
+            zone->max = val;
+        } else if (val < zone->min) {
+            zone->min = val;
+        } else if (val > zone->max) {
+            zone->max = val;
+        }
+    }
+    cf->values[cf->count++] = val;
+    update_bounds(cf->header, val);
+    cf->header->row_count = cf->count;
+    return 0;
+}
+
+/**
+ * Insert val at row pos, shifting every later value down by one.
+ * Used for tables clustered on a sorted column.
+ **/
+int column_file_insert_at(ColumnFile* cf, size_t pos, int val) {
+    if (cf == NULL || !cf->writable) {
+        return -1;
+    }
+    if (pos > cf->count) {
+        pos = cf->count;
+    }
+    if (cf->count == cf->capacity && grow(cf) == -1) {
+        return -1;
+    }
+    if ((pos > 0 && cf->values[pos - 1] > val) || (pos < cf->count && val > cf->values[pos])) {
+        cf->header->sorted = 0;
+    }
+    if (pos < cf->count) {
+        // rows from pos on are not where plans recorded before this expect them
+        cf->header->shifts++;
+    }
+    memmove(cf->values + pos + 1, cf->values + pos, (cf->count - pos) * sizeof(int));
+    cf->values[pos] = val;
+    cf->count++;
+    // every block from pos on shifted by one row
+    rebuild_zones(cf, pos / ZONE_SIZE);
+    update_bounds(cf->header, val);
+    cf->header->row_count = cf->count;
+    return 0;
+}
+
+/**
+ * Flush a writable column file to disk and trim it to exactly count values.
+ **/
+int column_file_sync(ColumnFile* cf) {
+    if (cf == NULL || !cf->writable) {
+        return 0;
+    }
+    if (cf->header != NULL && msync(cf->header, file_size_for(cf->capacity), MS_SYNC) == -1) {
+        perror("Unable to msync column file.\n");
+        return -1;
+    }
+    if (cf->zones != NULL && msync(cf->zones, cf->zone_capacity * sizeof(ColumnZone), MS_SYNC) == -1) {
+        perror("Unable to msync zone map.\n");
+        return -1;
+    }
+    unmap_values(cf);
+    cf->capacity = cf->count;
+    if (ftruncate(cf->fd, file_size_for(cf->capacity)) == -1) {
+        perror("Error trimming column file");
+        return -1;
+    }
+    if (map_values(cf) == -1) {
+        return -1;
+    }
+    return cf->zone_fd == -1 ? 0 : resize_zones(cf);
+}
+
+void column_file_close(ColumnFile* cf) {
+    if (cf == NULL) {
+        return;
+    }
+    column_file_sync(cf);
+    close_zones(cf);
+    unmap_values(cf);
+    close(cf->fd);
+    free(cf);
+}
@@ -0,0 +1,628 @@
+/**
+ * Contains the vectorized query operators.
+ *
+ * select, fetch, arithmetic and the aggregates over binary columns are parsed
+ * into DbOperator plans rather than being run on the spot. Selects, fetches
+ * and arithmetic are only recorded under their handle, pointing at the plans
+ * of the handles they read. A plan runs when an aggregate consumes it or when
+ * something else reads its handle, and it runs VECTOR_SIZE rows at a time:
+ * the select turns a chunk of its column into a selection vector, fetches
+ * gather the values of those rows, arithmetic combines the value vectors and
+ * the aggregate folds them in. Intermediates are never larger than one
+ * vector, so they stay in cache instead of going through memory between
+ * every step; full size results are only built for handles that are read.
+ *
+ * Plans are shared between handles: an entry holds a reference to its plan
+ * and a plan to the plans it reads, and a plan is freed with the last of
+ * them. A plan reads its column when it runs, so a clustered insert first
+ * runs the plans of its client over the table; plans of other clients fail
+ * rather than read rows the insert moved.
+ **/
+
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "db_operator.h"
+#include "aggregate.h"
+#include "arith_kernel.h"
+#include "bloom.h"
+#include "column_file.h"
+#include "parse.h"
+#include "positions.h"
+#include "shared_scan.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+// distinct columns one plan can read
+#define PLAN_MAX_COLUMNS 16
+
+/**
+ * PlanState
+ * What one run of a plan keeps between vectors.
+ * - columns: binary columns opened so far, by name
+ * - select/select_start: the select whose selection vector is in rows, and
+ *   the first row of the chunk it covers. Both sides of an arithmetic over
+ *   fetches of the same select reuse it instead of selecting twice.
+ **/
+typedef struct PlanState {
+    char names[PLAN_MAX_COLUMNS][MAX_SIZE_NAME];
+    ColumnFile* columns[PLAN_MAX_COLUMNS];
+    int num_columns;
+    const SelectOperator* select;
+    int select_start;
+    int num_selected;
+    int rows[VECTOR_SIZE];
+} PlanState;
+
+
+static ColumnFile* plan_column(PlanState* state, const char* name) {
+    for (int i = 0; i < state->num_columns; i++) {
+        if (strcmp(state->names[i], name) == 0) {
+            return state->columns[i];
+        }
+    }
+    if (state->num_columns == PLAN_MAX_COLUMNS) {
+        log_err("Plan reads too many columns\n");
+        return NULL;
+    }
+    ColumnFile* cf = open_binary_column((char*) name, NULL);
+    if (cf == NULL) {
+        perror("Error opening column");
+        return NULL;
+    }
+    strcpy(state->names[state->num_columns], name);
+    state->columns[state->num_columns++] = cf;
+    return cf;
+}
+
+static void plan_close(PlanState* state) {
+    for (int i = 0; i < state->num_columns; i++) {
+        column_file_close(state->columns[i]);
+    }
+    state->num_columns = 0;
+}
+
+/**
+ * Opens every column plan reads, so that runs over parts of its rows can
+ * start from a copy of state instead of each opening the columns again.
+ * Returns -1 if one cannot be opened.
+ **/
+static int plan_open(PlanState* state, const DbOperator* plan) {
+    switch (plan->type) {
+        case SELECT:
+            return plan_column(state, plan->operator_fields.select_operator.column) ? 0 : -1;
+        case FETCH:
+            if (plan_column(state, plan->operator_fields.fetch_operator.column) == NULL) {
+                return -1;
+            }
+            return plan_open(state, plan->operator_fields.fetch_operator.positions);
+        case ARITHMETIC: {
+            const ArithmeticOperator* arith = &plan->operator_fields.arithmetic_operator;
+            if (arith->left != NULL && plan_open(state, arith->left) < 0) {
+                return -1;
+            }
+            return arith->right != NULL ? plan_open(state, arith->right) : 0;
+        }
+        case AGGREGATE:
+            return plan_open(state, plan->operator_fields.aggregate_operator.input);
+        default:
+            return 0;
+    }
+}
+
+static bool same_select(const SelectOperator* a, const SelectOperator* b) {
+    return a == b || (a != NULL && b != NULL && strcmp(a->column, b->column) == 0
+            && a->low == b->low && a->high == b->high && a->num_rows == b->num_rows
+            && a->shifts == b->shifts && a->bloom == b->bloom);
+}
+
+/**
+ * The select every row of plan comes from, or NULL if its inputs do not
+ * line up row for row.
+ **/
+static const SelectOperator* plan_source(const DbOperator* plan) {
+    if (plan == NULL) {
+        return NULL;
+    }
+    switch (plan->type) {
+        case SELECT:
+            return &plan->operator_fields.select_operator;
+        case FETCH:
+            return plan_source(plan->operator_fields.fetch_operator.positions);
+        case ARITHMETIC: {
+            const ArithmeticOperator* arith = &plan->operator_fields.arithmetic_operator;
+            const SelectOperator* left = plan_source(arith->left);
+            const SelectOperator* right = plan_source(arith->right);
+            // a scalar operand lines up with any rows
+            if (arith->left == NULL) {
+                return right;
+            }
+            if (arith->right == NULL) {
+                return left;
+            }
+            return same_select(left, right) ? left : NULL;
+        }
+        case AGGREGATE:
+            return plan_source(plan->operator_fields.aggregate_operator.input);
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * Takes a reference to plan, which must have been recorded.
+ **/
+static void plan_retain(DbOperator* plan) {
+    if (plan != NULL) {
+        __sync_fetch_and_add(&plan->refs, 1);
+    }
+}
+
+/**
+ * Drops a reference to a recorded plan, freeing it and dropping its
+ * references to the plans it reads once nothing holds it.
+ **/
+void plan_release(DbOperator* plan) {
+    if (plan == NULL || __sync_sub_and_fetch(&plan->refs, 1) > 0) {
+        return;
+    }
+    if (plan->type == FETCH) {
+        plan_release(plan->operator_fields.fetch_operator.positions);
+    } else if (plan->type == ARITHMETIC) {
+        plan_release(plan->operator_fields.arithmetic_operator.left);
+        plan_release(plan->operator_fields.arithmetic_operator.right);
+    }
+    free(plan);
+}
+
+/**
+ * True if plan reads a column of table (db.tbl).
+ **/
+bool plan_reads_table(const DbOperator* plan, const char* table) {
+    if (plan == NULL) {
+        return false;
+    }
+    size_t len = strlen(table);
+    switch (plan->type) {
+        case SELECT: {
+            const char* column = plan->operator_fields.select_operator.column;
+            return strncmp(column, table, len) == 0 && column[len] == '.';
+        }
+        case FETCH: {
+            const char* column = plan->operator_fields.fetch_operator.column;
+            return (strncmp(column, table, len) == 0 && column[len] == '.')
+                || plan_reads_table(plan->operator_fields.fetch_operator.positions, table);
+        }
+        case ARITHMETIC:
+            return plan_reads_table(plan->operator_fields.arithmetic_operator.left, table)
+                || plan_reads_table(plan->operator_fields.arithmetic_operator.right, table);
+        default:
+            return false;
+    }
+}
+
+/**
+ * True if plan produces a value vector (a fetch or arithmetic over fetches
+ * and scalars).
+ **/
+bool plan_has_values(const DbOperator* plan) {
+    return plan != NULL && (plan->type == FETCH || plan->type == ARITHMETIC)
+        && plan_source(plan) != NULL;
+}
+
+/**
+ * True if left and right produce values for the same rows, so that they can
+ * be combined vector by vector.
+ **/
+bool plans_aligned(const DbOperator* left, const DbOperator* right) {
+    return plan_has_values(left) && plan_has_values(right)
+        && same_select(plan_source(left), plan_source(right));
+}
+
+/**
+ * True if rows of the select's column moved since the select was issued.
+ **/
+static bool rows_moved(const SelectOperator* select, const ColumnHeader* header) {
+    if (header->shifts != select->shifts) {
+        log_err("Rows of %s moved since the select was issued\n", select->column);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Rows of the select's column a run covers: those present when the select
+ * was issued and still mapped now.
+ **/
+static int plan_rows(PlanState* state, const SelectOperator* select) {
+    ColumnFile* cf = plan_column(state, select->column);
+    if (cf == NULL || rows_moved(select, cf->header)) {
+        return -1;
+    }
+    return (size_t) select->num_rows < cf->count ? select->num_rows : (int) cf->count;
+}
+
+/**
+ * Selection vector of select over rows [start, end), at most VECTOR_SIZE
+ * rows. Returns the number of rows in state->rows, or -1 on error.
+ **/
+static int select_vector(PlanState* state, const SelectOperator* select, int start, int end) {
+    if (state->select != NULL && same_select(state->select, select) && state->select_start == start) {
+        return state->num_selected;
+    }
+    ColumnFile* cf = plan_column(state, select->column);
+    if (cf == NULL) {
+        return -1;
+    }
+    uint64_t bitmap[VECTOR_SIZE / 64];
+    int words = (end - start + 63) / 64;
+    memset(bitmap, 0, words * sizeof(uint64_t));
+    select_binary_range(cf, select->low, select->high, bitmap, start, end);
+    if (select->bloom != NULL) {
+        bloom_filter_bitmap(select->bloom, cf->values + start, end - start, bitmap);
+    }
+
+    int count = 0;
+    for (int w = 0; w < words; w++) {
+        uint64_t bits = bitmap[w];
+        while (bits) {
+            state->rows[count++] = start + w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+    }
+    state->select = select;
+    state->select_start = start;
+    state->num_selected = count;
+    return count;
+}
+
+/**
+ * Values plan produces for rows [start, end) of its select, written to out
+ * (room for VECTOR_SIZE), with bit i of valid (VECTOR_SIZE / 64 words) set
+ * iff out[i] is not null. Returns how many, or -1 on error.
+ **/
+static int value_vector(PlanState* state, const DbOperator* plan, int start, int end, int* out, uint64_t* valid) {
+    switch (plan->type) {
+        case FETCH: {
+            const FetchOperator* fetch = &plan->operator_fields.fetch_operator;
+            ColumnFile* cf = plan_column(state, fetch->column);
+            int count = select_vector(state, plan_source(plan), start, end);
+            if (cf == NULL || count < 0) {
+                return -1;
+            }
+            const int* values = cf->values;
+            size_t num_values = cf->count;
+            int n = 0;
+            for (int i = 0; i < count; i++) {
+                int row = state->rows[i];
+                if ((size_t) row < num_values) {
+                    out[n++] = values[row];
+                }
+            }
+            memset(valid, 0, VECTOR_SIZE / 8);
+            bitmap_set_range(valid, 0, n);
+            return n;
+        }
+        case ARITHMETIC: {
+            const ArithmeticOperator* arith = &plan->operator_fields.arithmetic_operator;
+            int left[VECTOR_SIZE];
+            int right[VECTOR_SIZE];
+            uint64_t right_valid[VECTOR_SIZE / 64];
+            int n = VECTOR_SIZE;
+            if (arith->left != NULL) {
+                n = value_vector(state, arith->left, start, end, left, valid);
+            }
+            if (arith->right != NULL) {
+                int m = value_vector(state, arith->right, start, end, right, right_valid);
+                if (n < 0 || m < 0) {
+                    return -1;
+                }
+                if (arith->left == NULL) {
+                    memcpy(valid, right_valid, sizeof(right_valid));
+                } else {
+                    for (int w = 0; w < VECTOR_SIZE / 64; w++) {
+                        valid[w] &= right_valid[w];
+                    }
+                }
+                n = n < m ? n : m;
+            }
+            if (n < 0) {
+                return -1;
+            }
+            // the whole chain stays in these vectors, one operator at a time
+            arith_apply(arith->arith_type, arith->left ? left : NULL, arith->left_scalar,
+                        arith->right ? right : NULL, arith->right_scalar, n, out, valid);
+            return n;
+        }
+        default:
+            log_err("Plan does not produce values\n");
+            return -1;
+    }
+}
+
+/**
+ * AggregatePlanJob
+ * An aggregate plan on the thread pool. Each morsel runs the plan over its
+ * rows from a copy of shared, which has every column of the plan open, and
+ * folds the values into its own entry of partials.
+ **/
+typedef struct AggregatePlanJob {
+    const DbOperator* input;
+    const PlanState* shared;
+    AggregatePartial* partials;
+    int failed;
+} AggregatePlanJob;
+
+static void aggregate_plan_morsel(void* arg, int start, int end) {
+    AggregatePlanJob* job = (AggregatePlanJob*) arg;
+    AggregatePartial* partial = &job->partials[start / MORSEL_SIZE];
+    aggregate_partial_init(partial);
+
+    PlanState* state = malloc(sizeof(PlanState));
+    if (!state) {
+        perror("Memory allocation failed");
+        __sync_fetch_and_or(&job->failed, 1);
+        return;
+    }
+    memcpy(state->names, job->shared->names, sizeof(state->names));
+    memcpy(state->columns, job->shared->columns, sizeof(state->columns));
+    state->num_columns = job->shared->num_columns;
+    state->select = NULL;
+
+    int values[VECTOR_SIZE];
+    uint64_t valid[VECTOR_SIZE / 64];
+    for (int chunk = start; chunk < end; chunk += VECTOR_SIZE) {
+        int chunk_end = chunk + VECTOR_SIZE < end ? chunk + VECTOR_SIZE : end;
+        int n = value_vector(state, job->input, chunk, chunk_end, values, valid);
+        if (n < 0) {
+            __sync_fetch_and_or(&job->failed, 1);
+            break;
+        }
+        // aggregates skip nulls
+        n = arith_drop_nulls(values, n, valid);
+        aggregate_partial_add(partial, values, n);
+    }
+    // the shared columns are closed by the caller
+    for (int i = job->shared->num_columns; i < state->num_columns; i++) {
+        column_file_close(state->columns[i]);
+    }
+    free(state);
+}
+
+/**
+ * Runs an aggregate plan and stores its value under query->handle.
+ * Morsels of the select's rows run on the thread pool, each into a 64 bit
+ * partial of its own, and the partials are merged at the end.
+ **/
+static int run_aggregate(DbOperator* query) {
+    const AggregateOperator* agg = &query->operator_fields.aggregate_operator;
+    const SelectOperator* select = plan_source(agg->input);
+    if (!plan_has_values(agg->input) || select == NULL) {
+        log_err("Aggregate over a plan without values\n");
+        return -1;
+    }
+
+    PlanState state;
+    memset(&state, 0, sizeof(PlanState));
+    int num_rows = plan_rows(&state, select);
+    if (num_rows < 0 || plan_open(&state, agg->input) < 0) {
+        plan_close(&state);
+        return -1;
+    }
+    int num_morsels = (num_rows + MORSEL_SIZE - 1) / MORSEL_SIZE;
+    void* partials = NULL;
+    if (posix_memalign(&partials, sizeof(AggregatePartial),
+            (num_morsels > 0 ? num_morsels : 1) * sizeof(AggregatePartial)) != 0) {
+        perror("Memory allocation failed");
+        plan_close(&state);
+        return -1;
+    }
+    AggregatePlanJob job = { agg->input, &state, partials, 0 };
+    thread_pool_run(aggregate_plan_morsel, &job, 0, num_rows, MORSEL_SIZE);
+    plan_close(&state);
+
+    AggregatePartial total;
+    aggregate_partial_init(&total);
+    for (int i = 0; i < num_morsels; i++) {
+        aggregate_partial_merge(&total, &job.partials[i]);
+    }
+    free(partials);
+    if (job.failed) {
+        return -1;
+    }
+
+    CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+    if (!cat) {
+        perror("Failed to allocate memory for CatalogEntry");
+        return -1;
+    }
+    strcpy(cat->name, query->handle);
+    aggregate_partial_store(&total, agg->aggregate_type, cat);
+    cat->in_vpool = true;
+    put(query->variable_pool, *cat);
+    free(cat);
+    return 0;
+}
+
+/**
+ * Stores a select, fetch or arithmetic plan under query->handle without
+ * running it. The entry gets its own copy of query, holding the plans it
+ * reads.
+ **/
+static int record_plan(DbOperator* query) {
+    CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+    DbOperator* plan = malloc(sizeof(DbOperator));
+    if (!cat || !plan) {
+        perror("Failed to allocate memory for CatalogEntry");
+        free(cat);
+        free(plan);
+        return -1;
+    }
+    *plan = *query;
+    plan->refs = 1;
+    if (plan->type == FETCH) {
+        plan_retain(plan->operator_fields.fetch_operator.positions);
+    } else if (plan->type == ARITHMETIC) {
+        plan_retain(plan->operator_fields.arithmetic_operator.left);
+        plan_retain(plan->operator_fields.arithmetic_operator.right);
+    }
+    strcpy(cat->name, query->handle);
+    cat->plan = plan;
+    cat->in_vpool = true;
+    put(query->variable_pool, *cat);
+    free(cat);
+    return 0;
+}
+
+/**
+ * Runs query, which the parser built for one command. Selects, fetches and
+ * arithmetic are recorded for later; aggregates run their input right away.
+ * Returns -1 if the command could not be run.
+ **/
+int execute_db_operator(DbOperator* query) {
+    if (query == NULL) {
+        return -1;
+    }
+    switch (query->type) {
+        case SELECT:
+        case FETCH:
+        case ARITHMETIC:
+            return record_plan(query);
+        case AGGREGATE:
+            return run_aggregate(query);
+        default:
+            // create, insert and load are run by their parse functions
+            return -1;
+    }
+}
+
+/**
+ * Builds the whole position result of a select plan.
+ **/
+static int materialize_select(const SelectOperator* select, CatalogEntry* entry) {
+    ColumnHeader header;
+    if (read_column_header((char*) select->column, &header) == -1 || rows_moved(select, &header)) {
+        return -1;
+    }
+    uint64_t* bitmap = calloc((select->num_rows + 63) / 64 + 1, sizeof(uint64_t));
+    if (!bitmap) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    // selects on the same column from other clients share the scan
+    int num_rows = shared_scan_select(select, bitmap);
+    if (num_rows < 0) {
+        free(bitmap);
+        return -1;
+    }
+    positions_from_bitmap(entry, bitmap, num_rows);
+    return 0;
+}
+
+/**
+ * Builds the whole value vector of a fetch or arithmetic plan.
+ **/
+static int materialize_values(const DbOperator* plan, CatalogEntry* entry) {
+    PlanState state;
+    memset(&state, 0, sizeof(PlanState));
+    int num_rows = plan_rows(&state, plan_source(plan));
+    if (num_rows < 0) {
+        plan_close(&state);
+        return -1;
+    }
+    uint64_t valid[VECTOR_SIZE / 64];
+    int capacity = VECTOR_SIZE;
+    int* result = malloc(capacity * sizeof(int));
+    if (!result) {
+        perror("Memory allocation failed");
+        plan_close(&state);
+        return -1;
+    }
+    uint64_t* nulls = NULL;
+    int count = 0;
+    for (int start = 0; start < num_rows; start += VECTOR_SIZE) {
+        int end = start + VECTOR_SIZE < num_rows ? start + VECTOR_SIZE : num_rows;
+        if (count + VECTOR_SIZE > capacity) {
+            int* copy = realloc(result, capacity * 2 * sizeof(int));
+            if (!copy) {
+                perror("Allocation failure");
+                free(result);
+                plan_close(&state);
+                return -1;
+            }
+            result = copy;
+            capacity *= 2;
+        }
+        int n = value_vector(&state, plan, start, end, result + count, valid);
+        if (n < 0) {
+            free(result);
+            free(nulls);
+            plan_close(&state);
+            return -1;
+        }
+        // null rows stay in place, so the vector lines up with the select
+        for (int i = 0; i < n; i++) {
+            if (!arith_is_null(valid, i)) {
+                continue;
+            }
+            if (nulls == NULL && !(nulls = calloc((num_rows + 63) / 64 + 1, sizeof(uint64_t)))) {
+                perror("Memory allocation failed");
+                free(result);
+                plan_close(&state);
+                return -1;
+            }
+            nulls[(count + i) / 64] |= 1ULL << ((count + i) % 64);
+        }
+        count += n;
+    }
+    plan_close(&state);
+    if (nulls != NULL) {
+        // turn the null rows into the validity mask of the count values
+        for (int w = 0; w < (count + 63) / 64; w++) {
+            nulls[w] = ~nulls[w];
+        }
+        if (count % 64 != 0) {
+            nulls[count / 64] &= ~0ULL >> (64 - count % 64);
+        }
+    }
+    entry->valid = nulls;
+    entry->bitvector = result;
+    entry->bitv_capacity = capacity * sizeof(int);
+    entry->size = count;
+    entry->positions = POS_NONE;
+    entry->has_value = false;
+    if (plan->type == FETCH) {
+        // like an eager fetch, remember the column the values came from
+        strcpy(entry->filepath, plan->operator_fields.fetch_operator.column);
+    }
+    return 0;
+}
+
+/**
+ * Runs the plan recorded for entry, leaving entry as an eager select, fetch
+ * or arithmetic would have. Entries without a plan are left alone.
+ **/
+int materialize_result(CatalogEntry* entry) {
+    if (entry == NULL || entry->plan == NULL) {
+        return 0;
+    }
+    DbOperator* plan = entry->plan;
+    int ret;
+    if (plan->type == SELECT) {
+        ret = materialize_select(&plan->operator_fields.select_operator, entry);
+    } else if (plan_has_values(plan)) {
+        ret = materialize_values(plan, entry);
+    } else {
+        log_err("Cannot materialize plan\n");
+        ret = -1;
+    }
+    if (ret == 0) {
+        // plans that read it keep it until they are freed
+        entry->plan = NULL;
+        plan_release(plan);
+    }
+    return ret;
+}
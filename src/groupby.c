@@ -0,0 +1,424 @@
+/**
+ * Contains all functionality for group by aggregation.
+ *
+ * The hash group by runs in two phases on the thread pool. First every morsel
+ * of rows is pre-aggregated into a small open addressing table of its own,
+ * which fits in L2; whenever it fills up, and at the end of the morsel, its
+ * groups are flushed into the morsel's share of a set of hash partitions. A
+ * morsel only ever runs on one worker, so this needs no locks, and for the
+ * usual handful of keys each morsel hands on just a few partial groups.
+ * Then each partition, holding every partial of its keys, is merged into a
+ * final table by one worker, and the partitions' groups are concatenated.
+ *
+ * Keys that come from a clustered (or otherwise sorted) column need no hash
+ * table at all: every group is one run of equal keys, and a single streaming
+ * pass aggregates the runs as they go by.
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "groupby.h"
+#include "utils.h"
+
+#define GROUP_PARTITIONS (1 << GROUP_PARTITION_BITS)
+
+/**
+ * GroupState
+ * The running aggregates of one key. used marks a taken table slot.
+ **/
+typedef struct GroupState {
+    int key;
+    int min;
+    int max;
+    int used;
+    long long sum;
+    long long count;
+} GroupState;
+
+/**
+ * GroupRun
+ * Partial groups one morsel flushed to one partition.
+ **/
+typedef struct GroupRun {
+    GroupState* states;
+    int count;
+    int capacity;
+} GroupRun;
+
+/**
+ * GroupJob
+ * A hash group by on the thread pool. runs holds GROUP_PARTITIONS runs per
+ * morsel; outputs the finished groups of every partition.
+ **/
+typedef struct GroupJob {
+    const int* keys;
+    const int* values;
+    AggregateType type;
+    GroupRun* runs;
+    GroupResult* outputs;
+    int failed;
+} GroupJob;
+
+
+static inline unsigned int group_hash(int key) {
+    // murmur3 finalizer: the top bits pick the partition, the low bits the slot
+    unsigned int h = (unsigned int) key;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline int group_partition(unsigned int hash) {
+    return (int) (hash >> (32 - GROUP_PARTITION_BITS));
+}
+
+/**
+ * Slot of key in table (slots entries, a power of two), either its own or
+ * the free one it goes to.
+ **/
+static inline GroupState* group_slot(GroupState* table, int slots, int key, unsigned int hash) {
+    unsigned int mask = slots - 1;
+    unsigned int slot = hash & mask;
+    while (table[slot].used && table[slot].key != key) {
+        slot = (slot + 1) & mask;
+    }
+    return &table[slot];
+}
+
+static int group_run_append(GroupRun* run, const GroupState* state) {
+    if (run->count == run->capacity) {
+        int capacity = run->capacity > 0 ? run->capacity * 2 : 16;
+        GroupState* copy = realloc(run->states, capacity * sizeof(GroupState));
+        if (!copy) {
+            perror("Allocation failure");
+            return -1;
+        }
+        run->states = copy;
+        run->capacity = capacity;
+    }
+    run->states[run->count++] = *state;
+    return 0;
+}
+
+/**
+ * Moves the groups of table into the partition runs of a morsel and
+ * empties it.
+ **/
+static int flush_groups(GroupState* table, int slots, GroupRun* runs) {
+    int ret = 0;
+    for (int s = 0; s < slots; s++) {
+        if (table[s].used) {
+            if (group_run_append(&runs[group_partition(group_hash(table[s].key))], &table[s]) != 0) {
+                ret = -1;
+            }
+        }
+    }
+    memset(table, 0, slots * sizeof(GroupState));
+    return ret;
+}
+
+static void pre_aggregate_morsel(void* arg, int start, int end) {
+    GroupJob* job = arg;
+    GroupRun* runs = job->runs + (size_t) (start / MORSEL_SIZE) * GROUP_PARTITIONS;
+    GroupState* table = calloc(GROUP_LOCAL_SLOTS, sizeof(GroupState));
+    if (!table) {
+        perror("Memory allocation failed");
+        __sync_fetch_and_or(&job->failed, 1);
+        return;
+    }
+    int groups = 0;
+    for (int i = start; i < end; i++) {
+        int key = job->keys[i];
+        int value = job->values[i];
+        GroupState* group = group_slot(table, GROUP_LOCAL_SLOTS, key, group_hash(key));
+        if (!group->used) {
+            group->used = 1;
+            group->key = key;
+            group->min = value;
+            group->max = value;
+            groups++;
+        }
+        group->sum += value;
+        group->count++;
+        group->min = value < group->min ? value : group->min;
+        group->max = value > group->max ? value : group->max;
+        if (groups == GROUP_LOCAL_SLOTS / 2) {
+            if (flush_groups(table, GROUP_LOCAL_SLOTS, runs) != 0) {
+                __sync_fetch_and_or(&job->failed, 1);
+            }
+            groups = 0;
+        }
+    }
+    if (flush_groups(table, GROUP_LOCAL_SLOTS, runs) != 0) {
+        __sync_fetch_and_or(&job->failed, 1);
+    }
+    free(table);
+}
+
+static double group_value(const GroupState* group, AggregateType type) {
+    switch (type) {
+        case AGG_SUM: return (double) group->sum;
+        case AGG_AVG: return (double) group->sum / group->count;
+        case AGG_MIN: return group->min;
+        case AGG_MAX: return group->max;
+        case AGG_COUNT: return (double) group->count;
+    }
+    return 0;
+}
+
+typedef struct MergeJob {
+    GroupJob* job;
+    int num_morsels;
+} MergeJob;
+
+static void merge_partition_morsel(void* arg, int start, int end) {
+    MergeJob* merge = arg;
+    GroupJob* job = merge->job;
+    for (int p = start; p < end; p++) {
+        int partials = 0;
+        for (int m = 0; m < merge->num_morsels; m++) {
+            partials += job->runs[(size_t) m * GROUP_PARTITIONS + p].count;
+        }
+        int slots = 16;
+        while (slots < 2 * partials) {
+            slots <<= 1;
+        }
+        GroupState* table = calloc(slots, sizeof(GroupState));
+        GroupResult* output = &job->outputs[p];
+        output->keys = malloc((partials > 0 ? partials : 1) * sizeof(int));
+        output->values = malloc((partials > 0 ? partials : 1) * sizeof(double));
+        if (!table || !output->keys || !output->values) {
+            perror("Memory allocation failed");
+            __sync_fetch_and_or(&job->failed, 1);
+            free(table);
+            continue;
+        }
+        for (int m = 0; m < merge->num_morsels; m++) {
+            const GroupRun* run = &job->runs[(size_t) m * GROUP_PARTITIONS + p];
+            for (int i = 0; i < run->count; i++) {
+                const GroupState* partial = &run->states[i];
+                GroupState* group = group_slot(table, slots, partial->key, group_hash(partial->key));
+                if (!group->used) {
+                    *group = *partial;
+                    continue;
+                }
+                group->sum += partial->sum;
+                group->count += partial->count;
+                group->min = partial->min < group->min ? partial->min : group->min;
+                group->max = partial->max > group->max ? partial->max : group->max;
+            }
+        }
+        int count = 0;
+        for (int s = 0; s < slots; s++) {
+            if (table[s].used) {
+                output->keys[count] = table[s].key;
+                output->values[count] = group_value(&table[s], job->type);
+                count++;
+            }
+        }
+        output->count = count;
+        free(table);
+    }
+}
+
+void group_result_free(GroupResult* result) {
+    free(result->keys);
+    free(result->values);
+    result->keys = NULL;
+    result->values = NULL;
+    result->count = 0;
+}
+
+/**
+ * Groups values[i] by keys[i] for i < n and aggregates every group, into
+ * result (allocated here). Groups come out in no particular order.
+ **/
+int hash_group_by(const int* keys, const int* values, int n, AggregateType type, GroupResult* result) {
+    int num_morsels = (n + MORSEL_SIZE - 1) / MORSEL_SIZE;
+    GroupJob job;
+    job.keys = keys;
+    job.values = values;
+    job.type = type;
+    job.failed = 0;
+    job.runs = calloc((size_t) (num_morsels > 0 ? num_morsels : 1) * GROUP_PARTITIONS, sizeof(GroupRun));
+    job.outputs = calloc(GROUP_PARTITIONS, sizeof(GroupResult));
+    result->keys = NULL;
+    result->values = NULL;
+    result->count = 0;
+    if (!job.runs || !job.outputs) {
+        perror("Memory allocation failed");
+        free(job.runs);
+        free(job.outputs);
+        return -1;
+    }
+
+    thread_pool_run(pre_aggregate_morsel, &job, 0, n, MORSEL_SIZE);
+    if (!job.failed) {
+        MergeJob merge = { &job, num_morsels };
+        thread_pool_run(merge_partition_morsel, &merge, 0, GROUP_PARTITIONS, 1);
+    }
+
+    int total = 0;
+    for (int p = 0; p < GROUP_PARTITIONS; p++) {
+        total += job.outputs[p].count;
+    }
+    int ret = job.failed ? -1 : 0;
+    if (ret == 0) {
+        result->keys = malloc((total > 0 ? total : 1) * sizeof(int));
+        result->values = malloc((total > 0 ? total : 1) * sizeof(double));
+        if (!result->keys || !result->values) {
+            perror("Memory allocation failed");
+            group_result_free(result);
+            ret = -1;
+        }
+    }
+    for (int p = 0; p < GROUP_PARTITIONS; p++) {
+        if (ret == 0) {
+            memcpy(result->keys + result->count, job.outputs[p].keys, job.outputs[p].count * sizeof(int));
+            memcpy(result->values + result->count, job.outputs[p].values, job.outputs[p].count * sizeof(double));
+            result->count += job.outputs[p].count;
+        }
+        group_result_free(&job.outputs[p]);
+    }
+    for (size_t r = 0; r < (size_t) num_morsels * GROUP_PARTITIONS; r++) {
+        free(job.runs[r].states);
+    }
+    free(job.runs);
+    free(job.outputs);
+    return ret;
+}
+
+/**
+ * SortedJob
+ * A group by over keys in order on the thread pool: runs[m] gets the groups
+ * of morsel m, in key order.
+ **/
+typedef struct SortedJob {
+    const int* keys;
+    const int* values;
+    GroupRun* runs;
+    int unsorted;
+    int failed;
+} SortedJob;
+
+static void run_morsel_groups(void* arg, int start, int end) {
+    SortedJob* job = arg;
+    GroupRun* run = &job->runs[start / MORSEL_SIZE];
+    if (job->unsorted) {
+        return;
+    }
+    GroupState group;
+    memset(&group, 0, sizeof(GroupState));
+    for (int i = start; i < end; i++) {
+        int key = job->keys[i];
+        int value = job->values[i];
+        if (group.used && key != group.key) {
+            if (key < group.key) {
+                __sync_fetch_and_or(&job->unsorted, 1);
+                return;
+            }
+            if (group_run_append(run, &group) != 0) {
+                __sync_fetch_and_or(&job->failed, 1);
+                return;
+            }
+            group.used = 0;
+        }
+        if (!group.used) {
+            group.used = 1;
+            group.key = key;
+            group.min = value;
+            group.max = value;
+            group.sum = 0;
+            group.count = 0;
+        }
+        group.sum += value;
+        group.count++;
+        group.min = value < group.min ? value : group.min;
+        group.max = value > group.max ? value : group.max;
+    }
+    if (group.used && group_run_append(run, &group) != 0) {
+        __sync_fetch_and_or(&job->failed, 1);
+    }
+}
+
+/**
+ * Group by for keys already in ascending order, as fetched from a clustered
+ * or sorted column, in one streaming pass without a hash table. Morsels
+ * aggregate their own runs in parallel, and a run that a morsel boundary
+ * cut in two is joined up again. Groups come out in key order.
+ * Returns 1, with nothing in result, if keys turn out not to be in order.
+ **/
+int sorted_group_by(const int* keys, const int* values, int n, AggregateType type, GroupResult* result) {
+    int num_morsels = (n + MORSEL_SIZE - 1) / MORSEL_SIZE;
+    SortedJob job;
+    job.keys = keys;
+    job.values = values;
+    job.unsorted = 0;
+    job.failed = 0;
+    job.runs = calloc(num_morsels > 0 ? num_morsels : 1, sizeof(GroupRun));
+    result->keys = NULL;
+    result->values = NULL;
+    result->count = 0;
+    if (!job.runs) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    thread_pool_run(run_morsel_groups, &job, 0, n, MORSEL_SIZE);
+
+    int ret = job.failed ? -1 : (job.unsorted ? 1 : 0);
+    int total = 0;
+    for (int m = 0; m < num_morsels; m++) {
+        total += job.runs[m].count;
+    }
+    GroupState* groups = NULL;
+    if (ret == 0) {
+        groups = malloc((total > 0 ? total : 1) * sizeof(GroupState));
+        if (!groups) {
+            perror("Memory allocation failed");
+            ret = -1;
+        }
+    }
+    int count = 0;
+    for (int m = 0; ret == 0 && m < num_morsels; m++) {
+        for (int i = 0; ret == 0 && i < job.runs[m].count; i++) {
+            const GroupState* partial = &job.runs[m].states[i];
+            GroupState* last = count > 0 ? &groups[count - 1] : NULL;
+            if (last == NULL || partial->key > last->key) {
+                groups[count++] = *partial;
+            } else if (partial->key == last->key) {
+                last->sum += partial->sum;
+                last->count += partial->count;
+                last->min = partial->min < last->min ? partial->min : last->min;
+                last->max = partial->max > last->max ? partial->max : last->max;
+            } else {
+                ret = 1;
+            }
+        }
+    }
+    if (ret == 0) {
+        result->keys = malloc((count > 0 ? count : 1) * sizeof(int));
+        result->values = malloc((count > 0 ? count : 1) * sizeof(double));
+        if (!result->keys || !result->values) {
+            perror("Memory allocation failed");
+            group_result_free(result);
+            ret = -1;
+        }
+    }
+    for (int i = 0; ret == 0 && i < count; i++) {
+        result->keys[i] = groups[i].key;
+        result->values[i] = group_value(&groups[i], type);
+    }
+    if (ret == 0) {
+        result->count = count;
+    }
+    free(groups);
+    for (int m = 0; m < num_morsels; m++) {
+        free(job.runs[m].states);
+    }
+    free(job.runs);
+    return ret;
+}
@@ -0,0 +1,25 @@
+/**
+ * Contains function definitions for the
+ * parallel scalar aggregates.
+ **/
+
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "cs165_api.h"
+#include "thread_pool.h"
+
+/*******************************************/
+/* Functions for aggregate partials        */
+void aggregate_partial_init(AggregatePartial* partial);
+void aggregate_partial_add(AggregatePartial* partial, const int* values, int n);
+void aggregate_partial_merge(AggregatePartial* into, const AggregatePartial* from);
+void aggregate_partial_store(const AggregatePartial* partial, AggregateType type, CatalogEntry* entry);
+/*******************************************/
+
+/*******************************************/
+/* Functions for aggregating values        */
+int aggregate_values(const int* values, const uint64_t* valid, int n, AggregatePartial* total);
+/*******************************************/
+
+#endif
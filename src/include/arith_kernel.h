@@ -0,0 +1,31 @@
+/**
+ * Contains function definitions for the
+ * vectorized arithmetic kernels.
+ **/
+
+#ifndef ARITH_KERNEL_H
+#define ARITH_KERNEL_H
+
+#include <stdint.h>
+
+#include "cs165_api.h"
+
+// values handled per call of a kernel; scalar operands are broadcast into a
+// buffer of this size once
+#define ARITH_CHUNK 1024
+
+/*******************************************/
+/* Functions for evaluating left op right  */
+const char* arith_kernel_name(void);
+void arith_apply(ArithmeticType type, const int* left, int left_scalar,
+                 const int* right, int right_scalar, int n, int* out, uint64_t* valid);
+/*******************************************/
+
+/*******************************************/
+/* Functions for validity masks            */
+bool arith_is_null(const uint64_t* valid, int i);
+int arith_count_nulls(const uint64_t* valid, int n);
+int arith_drop_nulls(int* values, int n, const uint64_t* valid);
+/*******************************************/
+
+#endif
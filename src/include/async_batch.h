@@ -0,0 +1,18 @@
+/**
+ * Contains function definitions for running
+ * a batch's commands as a dependency graph.
+ **/
+
+#ifndef ASYNC_BATCH_H
+#define ASYNC_BATCH_H
+
+#include "cs165_api.h"
+#include "message.h"
+
+/*******************************************/
+/* Functions for running an async batch    */
+int async_batch_run(char** commands, int num_commands, int client_socket, ClientContext* context,
+                    CatalogHashtable* variable_pool, Queue* batch_queue, message_status* status);
+/*******************************************/
+
+#endif
@@ -0,0 +1,32 @@
+/**
+ * Contains function definitions for the
+ * batched (shared scan) selects and fetches.
+ **/
+
+#ifndef BATCH_SELECT_H
+#define BATCH_SELECT_H
+
+#include "cs165_api.h"
+#include "thread_pool.h"
+
+// rows evaluated against every predicate of a batch at a time (16KB of
+// values, so the tile stays in L1 while the predicates run over it)
+#define BATCH_TILE 4096
+// from this many predicates on, rows find the predicates they match
+// through the sorted bounds of the batch instead of trying every one
+#define BATCH_SORTED_MIN_PREDICATES 16
+// most (interval, predicate) pairs the sorted bounds may list; batches of
+// heavily overlapping ranges above it evaluate every predicate instead
+#define BATCH_MAX_COVER (1 << 22)
+
+/*******************************************/
+/* Functions for evaluating a batch        */
+void batch_select_bitmaps(const int* values, int num_rows, SelectObject** selects, int num_selects,
+                          uint64_t** bitmaps, bool parallel);
+void batch_select_index(const int* values, const int* positions, int count, SelectObject** selects,
+                        int num_selects, uint64_t** bitmaps);
+void batch_gather(const int* values, int num_rows, CatalogEntry** positions, int num_fetches,
+                  int** results, int* counts);
+/*******************************************/
+
+#endif
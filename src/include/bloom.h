@@ -0,0 +1,29 @@
+/**
+ * Contains function definitions for the
+ * Bloom filters used to prune join inputs.
+ **/
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include "cs165_api.h"
+
+// 32 bit words per block; a block is one 32 byte half of a cache line
+#define BLOOM_BLOCK_WORDS 8
+// filter bits per key, for about 1% false positives
+#define BLOOM_BITS_PER_KEY 10
+
+/*******************************************/
+/* Functions for building filters          */
+BloomFilter* bloom_create(int num_keys);
+void bloom_add(BloomFilter* bloom, int key);
+void bloom_free(BloomFilter* bloom);
+/*******************************************/
+
+/*******************************************/
+/* Functions for testing keys              */
+bool bloom_may_contain(const BloomFilter* bloom, int key);
+void bloom_filter_bitmap(const BloomFilter* bloom, const int* values, int n, uint64_t* bitmap);
+/*******************************************/
+
+#endif
@@ -11,8 +11,16 @@
 int find_pos(BPTreeNode* root, int val, int min);
 BPTreeNode* find_leaf_node(BPTreeNode* root, int val);
 void find_pos_range(BPTreeNode* root, int* num_results, int** ret_indices, int* min_val, int* max_val);
+BPTreeNode* first_leaf(BPTreeNode* root);
 /***********************************/
 
+/*************************************************/
+/* Functions for persisting and freeing b+ trees */
+void dump_bptree(FILE* fd, BPTreeNode* root, int* base_data);
+void* load_bptree(FILE* fd, int* base_data);
+void free_node(BPTreeNode* node);
+/*************************************************/
+
 /************************************************/
 /* Functions for updating/deleting from b+ tree */
 void bplus_remove(BPTreeNode* root, int val, int pos);
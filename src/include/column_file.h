@@ -0,0 +1,35 @@
+/**
+ * Contains function definitions for the
+ * binary (packed int32) column files.
+ **/
+
+#ifndef COLUMN_FILE_H
+#define COLUMN_FILE_H
+
+#include "cs165_api.h"
+
+// number of values a freshly created binary column file can hold
+#define COLUMN_FILE_START_CAPACITY 10240
+
+/*******************************************/
+/* Functions for naming and opening files  */
+char* column_bin_path(const char* col_path);
+ColumnFile* column_file_create(const char* col_path);
+ColumnFile* column_file_open(const char* col_path, bool writable);
+int column_file_read_header(const char* col_path, ColumnHeader* header);
+void column_file_close(ColumnFile* cf);
+/*******************************************/
+
+/*******************************************/
+/* Functions for writing values            */
+int column_file_append(ColumnFile* cf, int val);
+int column_file_insert_at(ColumnFile* cf, size_t pos, int val);
+int column_file_sync(ColumnFile* cf);
+/*******************************************/
+
+/*******************************************/
+/* Functions for the zone map              */
+size_t column_file_zone_count(const ColumnFile* cf);
+/*******************************************/
+
+#endif
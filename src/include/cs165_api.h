@@ -27,6 +27,7 @@ SOFTWARE.
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 // My additions
@@ -61,6 +62,70 @@ typedef struct Column {
     int count; //dunno how i will even keep track of entry count but maybe
 } Column;
 
+/**
+ * ColumnHeader
+ * Fixed layout metadata block at the start of every binary column file.
+ * It is padded to 64 bytes so the values that follow stay cache line aligned.
+ * - magic/version: identify the file format
+ * - row_count: number of values in the file
+ * - min/max: smallest and largest value (INT_MAX/INT_MIN while empty)
+ * - sorted: 1 if the values are in non-decreasing order
+ **/
+
+#define COLUMN_FILE_MAGIC 0x314C4F43 // "COL1" on disk (little endian)
+#define COLUMN_FILE_VERSION 2
+
+// number of values summarised by each zone map entry
+#define ZONE_SIZE 4096
+
+typedef struct ColumnHeader {
+    unsigned int magic;
+    unsigned int version;
+    long long row_count;
+    int min;
+    int max;
+    int sorted;
+    int zone_size; // rows per zone in the .zmp zone map file
+    unsigned int shifts; // inserts that moved rows already in the column
+    char padding[28];
+} ColumnHeader;
+
+/**
+ * ColumnZone
+ * min/max of one ZONE_SIZE block of a binary column. Zone i covers rows
+ * [i * ZONE_SIZE, (i + 1) * ZONE_SIZE) and lives in db/tbl/col.zmp.
+ **/
+typedef struct ColumnZone {
+    int min;
+    int max;
+} ColumnZone;
+
+/**
+ * ColumnFile
+ * Binary on-disk copy of a column: a ColumnHeader followed by packed int32
+ * values in row order, living next to the text file (db/tbl/col.bin beside
+ * db/tbl/col.txt).
+ * - header: the mapped metadata block, kept up to date on every write
+ * - values: the memory mapped values, scanned directly by queries
+ * - count: number of values written (mirrors header->row_count)
+ * - capacity: number of values the current mapping (and file) can hold
+ * - writable: false for read-only mappings opened by queries
+ * - zones: per block min/max summaries used to skip blocks in selects
+ **/
+
+typedef struct ColumnFile {
+    char path[MAX_SIZE_NAME];
+    int fd;
+    ColumnHeader* header;
+    int* values;
+    size_t count;
+    size_t capacity;
+    bool writable;
+    int zone_fd;
+    ColumnZone* zones; // mapped zone map, NULL if the column has none
+    size_t zone_capacity; // number of zones the mapping can hold
+} ColumnFile;
+
 /**
  * table
  * Defines a table structure, which is composed of multiple columns.
@@ -129,6 +194,7 @@ typedef struct Status {
 // Structure for shared scan context.
 typedef struct SelectObject{
     char handle[MAX_SIZE_NAME];
+    char column[MAX_SIZE_NAME]; // db.tbl.col the select scans
     int minval; // Starting index of the scan.
     int maxval; // Ending index of the scan.
     int* results; // to store results
@@ -145,6 +211,10 @@ typedef enum OperatorType {
     CREATE,
     INSERT,
     LOAD,
+    SELECT,
+    FETCH,
+    ARITHMETIC,
+    AGGREGATE,
 } OperatorType;
 
 
@@ -182,6 +252,62 @@ typedef struct InsertOperator {
 typedef struct LoadOperator {
     char* file_name;
 } LoadOperator;
+/*
+ * necessary fields for a select over a binary column
+ * num_rows is the row count of the column when the select was issued, rows
+ * appended after that are not part of the result
+ * shifts is the column's header.shifts then, the plan cannot run once an
+ * insert has moved the rows under it
+ * parallel runs the select on the worker pool when the whole result is built
+ */
+typedef struct SelectOperator {
+    char column[MAX_SIZE_NAME];
+    int low;
+    int high;
+    int num_rows;
+    unsigned int shifts;
+    bool parallel;
+    struct BloomFilter* bloom; // if set, rows must also pass this filter
+} SelectOperator;
+/*
+ * necessary fields for a fetch from a binary column
+ * positions is the plan of the select whose rows are fetched
+ */
+typedef struct FetchOperator {
+    char column[MAX_SIZE_NAME];
+    struct DbOperator* positions;
+} FetchOperator;
+/*
+ * necessary fields for arithmetic over value plans of the same rows
+ * an operand without a plan is its scalar, broadcast to every row
+ */
+typedef enum ArithmeticType {
+    ARITH_ADD,
+    ARITH_SUB,
+    ARITH_MUL,
+    ARITH_DIV,
+} ArithmeticType;
+typedef struct ArithmeticOperator {
+    ArithmeticType arith_type;
+    struct DbOperator* left;
+    struct DbOperator* right;
+    int left_scalar;
+    int right_scalar;
+} ArithmeticOperator;
+/*
+ * necessary fields for an aggregate over a value plan
+ */
+typedef enum AggregateType {
+    AGG_SUM,
+    AGG_AVG,
+    AGG_MIN,
+    AGG_MAX,
+    AGG_COUNT,
+} AggregateType;
+typedef struct AggregateOperator {
+    AggregateType aggregate_type;
+    struct DbOperator* input;
+} AggregateOperator;
 /*
  * union type holding the fields of any operator
  */
@@ -189,6 +315,10 @@ typedef union OperatorFields {
     CreateOperator create_operator;
     InsertOperator insert_operator;
     LoadOperator load_operator;
+    SelectOperator select_operator;
+    FetchOperator fetch_operator;
+    ArithmeticOperator arithmetic_operator;
+    AggregateOperator aggregate_operator;
 } OperatorFields;
 /*
  * DbOperator holds the following fields:
@@ -209,12 +339,17 @@ typedef struct {
     char handle[MAX_SIZE_NAME];
     char filepath[MAX_SIZE_NAME];
     bool is_column;
-    int pvector[10240];
-    int vvector[10240];
+    int* values; // mapped binary column, NULL when scanning the text file
+    ColumnFile* column; // the binary column values belongs to
+    uint64_t* bitmap; // result bitmap when scanning a binary column
+    struct BloomFilter* bloom; // join keys a qualifying row must also match, or NULL
+    long* lineOffsets; // byte offset of every line when scanning the text file
 
     int* bitvector;
     SelectObject** selects;
     int numSelects;
+    uint64_t* segments; // private result blocks of every morsel of a batch
+    int segment_words; // words of one select's segment in a block
     
     // Other necessary fields
 } ThreadArgs;
@@ -266,6 +401,21 @@ typedef struct LeafIndexRes {
 
 // CODE FOR HASHTABLE IMPLEMENTATION OF CATALOG -> also used for variable pool
 
+/**
+ * PositionFormat
+ * How the result of a select is stored in the variable pool.
+ * - POS_NONE: not a position result (value vectors, columns, scalars)
+ * - POS_BITMAP: bitmap holds one bit per row of the column
+ * - POS_LIST: bitvector holds the qualifying rows in ascending order, or for
+ *   join results, and selects over them, the rows in match order (rows may
+ *   repeat)
+ **/
+typedef enum PositionFormat {
+    POS_NONE,
+    POS_BITMAP,
+    POS_LIST
+} PositionFormat;
+
 typedef struct CatalogEntry {
     char name[MAX_SIZE_NAME];
     char filepath[MAX_SIZE_NAME];
@@ -289,12 +439,96 @@ typedef struct CatalogEntry {
     int num_lines;
     int num_entries; // for int* implementation
     int offset;
-    bool has_value;
-    float value; // For arithmetic operators
+    bool has_value; // a single value, int_value if is_int and value otherwise
+    bool is_int;
+    long long int_value; // sums, counts, min and max, exact over 64 bits
+    double value; // averages
+    // packed binary copy of the column (shared between copies of the entry).
+    // Its header holds the row count, min, max and sorted flag of the column;
+    // they are not copied onto the entry, since put() copies entries and a
+    // copy would go stale on the next append
+    ColumnFile* binfile;
+    PositionFormat positions; // set for select results, size is then the number of qualifying rows
+    uint64_t* bitmap; // POS_BITMAP: one bit per row
+    int num_rows; // rows in the column a position result refers to
+    struct DbOperator* plan; // select/fetch/arithmetic not run yet, NULL once materialized
+    struct BloomFilter* bloom; // set for bloom() results
+    uint64_t* valid; // value vectors: bit i clear if bitvector[i] is null (divided by zero), NULL if none is
+    double* dvector; // group averages, and sums too large for an int (size of them), in place of bitvector
 } CatalogEntry;
 
+/**
+ * PositionCursor
+ * Walks the qualifying rows of a position result in the order they are
+ * held, ascending unless they come from a join, whatever its format.
+ **/
+typedef struct PositionCursor {
+    const CatalogEntry* entry;
+    int index; // next list entry, or next bitmap word
+    uint64_t bits; // POS_BITMAP: unvisited bits of the current word
+    int base; // POS_BITMAP: row of bit 0 of the current word
+} PositionCursor;
+
+/**
+ * JoinInput
+ * One side of a join: values[i] is the join key of row positions[i].
+ **/
+typedef struct JoinInput {
+    int* values;
+    int* positions;
+    int count;
+} JoinInput;
+
+/**
+ * JoinResult
+ * The matching row pairs of a join: row left[i] joins with row right[i].
+ **/
+typedef struct JoinResult {
+    int* left;
+    int* right;
+    int count;
+    int capacity;
+} JoinResult;
+
+/**
+ * BloomFilter
+ * Keys of a join's build side, for pruning the other side's scans.
+ * num_blocks (a power of two) blocks of BLOOM_BLOCK_WORDS words.
+ **/
+typedef struct BloomFilter {
+    uint32_t* blocks;
+    int num_blocks;
+} BloomFilter;
+
+/**
+ * AggregatePartial
+ * Running sum, count, min and max over part of the input of an aggregate.
+ * Padded to a cache line, so that workers filling partials next to each
+ * other do not keep taking the line from one another.
+ **/
+typedef struct AggregatePartial {
+    long long sum;
+    long long count;
+    int min;
+    int max;
+    char padding[64 - 2 * sizeof(long long) - 2 * sizeof(int)];
+} AggregatePartial;
+
+/**
+ * GroupResult
+ * The result of a group by: one row per distinct key, keys[i] and the
+ * aggregate of its values, values[i].
+ **/
+typedef struct GroupResult {
+    int* keys;
+    double* values;
+    int count;
+} GroupResult;
+
 typedef struct CatalogHashtable {
     CatalogEntry* table[5003]; // An array of pointers to entries
+    pthread_mutex_t mutex; // held while the buckets are read or changed
+    CatalogEntry* retired; // replaced and erased entries, freed by release_retired()
 } CatalogHashtable;
 
 typedef struct Tb {
@@ -314,12 +548,16 @@ typedef struct ClientContext {
     int num_tables;
     // So we can know whether or not we are within a batch query
     bool is_batch;
-    char batch_identifier[MAX_SIZE_NAME];
     SelectObject* selects[1000];
     int num_selects;
+    // the other commands of a batch ("handle=query"), run after its selects
+    char* batch_commands[1000];
+    int num_batch_commands;
     // For loading -> to be persisted upon shutdown
     //char* cols_in_vpool[2040];
     bool multithread;
+    // commands of the batch run as a dependency graph (async_queries())
+    bool async;
     
 } ClientContext;
 
@@ -328,6 +566,9 @@ typedef struct DbOperator {
     OperatorFields operator_fields;
     int client_fd;
     ClientContext* context;
+    char handle[MAX_SIZE_NAME]; // where the result goes in variable_pool
+    CatalogHashtable* variable_pool;
+    int refs; // entries and plans holding a recorded plan, see plan_release()
 } DbOperator;
 
 extern Db *current_db;
@@ -335,13 +576,36 @@ extern Db *current_db;
 
 // QUEUE IS FOR MULTIPLE CORE USE
 
-// A node in the queue.
+// Callback run by the worker pool on rows [start, end) of a job.
+typedef void (*MorselFunction)(void* arg, int start, int end);
+
+/**
+ * MorselJob
+ * One parallel operation submitted to the worker pool, split into morsels
+ * of morsel_size rows that are spread over the workers' queues.
+ * - remaining: morsels not yet finished; the submitter waits for 0
+ * - nodes: queue nodes for every morsel, freed by the submitter
+ **/
+typedef struct MorselJob {
+    MorselFunction func;
+    void* arg;
+    int remaining;
+    struct node* nodes;
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+} MorselJob;
+
+// A node in the queue: one morsel [start, end) of a job.
 typedef struct node {
-    SelectObject query;
+    MorselJob* job;
+    int start;
+    int end;
     struct node* next;
+    struct node* prev;
 } node_t;
 
-// A thread-safe queue with mutex.
+// A thread-safe double ended queue with mutex. The owning worker takes
+// from the tail, other threads steal from the head.
 typedef struct Queue {
     node_t* head;
     node_t* tail;
@@ -349,6 +613,23 @@ typedef struct Queue {
     pthread_cond_t cond;
 } Queue;
 
+/**
+ * ThreadPool
+ * Server-wide set of worker threads created once at startup. Every worker
+ * owns one Queue of morsels and steals from the others when it runs dry.
+ * - queued: morsels sitting in any queue; idle workers sleep while it is 0
+ **/
+typedef struct ThreadPool {
+    pthread_t* threads;
+    Queue* queues;
+    int num_threads;
+    int next_id;
+    int queued;
+    bool shutdown;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} ThreadPool;
+
 
 
 /* 
@@ -366,7 +647,7 @@ Column* create_column(Table *table, char *name, bool sorted, Status *ret_status)
 
 Status shutdown_server();
 
-char** execute_db_operator(DbOperator* query);
+int execute_db_operator(DbOperator* query);
 void db_operator_free(DbOperator* query);
 
 
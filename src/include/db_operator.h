@@ -0,0 +1,28 @@
+/**
+ * Contains function definitions for the
+ * vectorized query operators.
+ **/
+
+#ifndef DB_OPERATOR_H
+#define DB_OPERATOR_H
+
+#include "cs165_api.h"
+
+// rows pulled through a plan at a time; small enough that every
+// intermediate vector stays in L1/L2
+#define VECTOR_SIZE 1024
+
+/*******************************************/
+/* Functions for inspecting plans          */
+bool plan_has_values(const DbOperator* plan);
+bool plans_aligned(const DbOperator* left, const DbOperator* right);
+bool plan_reads_table(const DbOperator* plan, const char* table);
+/*******************************************/
+
+/*******************************************/
+/* Functions for running plans             */
+int materialize_result(CatalogEntry* entry);
+void plan_release(DbOperator* plan);
+/*******************************************/
+
+#endif
@@ -0,0 +1,25 @@
+/**
+ * Contains function definitions for the
+ * group by aggregations.
+ **/
+
+#ifndef GROUPBY_H
+#define GROUPBY_H
+
+#include "cs165_api.h"
+#include "thread_pool.h"
+
+// slots of the table a morsel pre-aggregates into (32 bytes each, so the
+// table stays within L2); it is flushed once half full
+#define GROUP_LOCAL_SLOTS 4096
+// partitions the pre-aggregated groups are merged in, one worker each
+#define GROUP_PARTITION_BITS 6
+
+/*******************************************/
+/* Functions for grouping                  */
+int hash_group_by(const int* keys, const int* values, int n, AggregateType type, GroupResult* result);
+int sorted_group_by(const int* keys, const int* values, int n, AggregateType type, GroupResult* result);
+void group_result_free(GroupResult* result);
+/*******************************************/
+
+#endif
@@ -0,0 +1,63 @@
+/**
+ * Contains function definitions for the
+ * join algorithms.
+ **/
+
+#ifndef JOIN_H
+#define JOIN_H
+
+#include "cs165_api.h"
+#include "thread_pool.h"
+
+// build side tuples per radix partition: a partition and its hash table
+// (8 + 8 bytes per tuple) then stay within L2
+#define JOIN_PARTITION_TUPLES 4096
+// at most 2^JOIN_MAX_RADIX_BITS partitions, to keep the scatter within the TLB
+#define JOIN_MAX_RADIX_BITS 12
+// nested-loop join: inner values compared at once (16KB, within L1) and
+// outer values run against each inner tile (128KB, within L2)
+#define JOIN_INNER_TILE 4096
+#define JOIN_OUTER_BLOCK 32768
+// parallel hash join: partitions joined per morsel of work, at least this
+// many partitions per worker so that uneven partitions even out
+#define JOIN_PARTITIONS_PER_MORSEL 4
+#define JOIN_PARTITIONS_PER_WORKER 8
+// smaller joins are not worth handing out to the pool
+#define JOIN_PARALLEL_MIN_TUPLES (4 * MORSEL_SIZE)
+// working memory a hash join may use before it spills partitions to disk.
+// It bounds the partitioned copies and hash tables only: both inputs are
+// handle vectors that stay in memory, and the result is built in memory as
+// the position vectors it is returned as, so neither counts against it
+#ifndef JOIN_MEMORY_BUDGET
+#define JOIN_MEMORY_BUDGET (64 * 1024 * 1024)
+#endif
+// most spilled partitions per pass; the open file limit may allow fewer,
+// as every pass on the way down keeps its files open (see grace_join)
+#define JOIN_MAX_SPILL_PARTITIONS 256
+// open files left to the rest of the server when sizing spill passes
+#define JOIN_RESERVED_FILES 64
+// passes over a partition that is still too large before it is joined in
+// memory anyway (a single hot key cannot be split further)
+#define JOIN_MAX_SPILL_DEPTH 3
+// tuples buffered per partition file between writes
+#define JOIN_SPILL_BATCH 512
+
+/*******************************************/
+/* Functions for join results              */
+int join_result_init(JoinResult* result, int capacity);
+int join_result_append(JoinResult* result, int left, int right);
+void join_result_free(JoinResult* result);
+/*******************************************/
+
+/*******************************************/
+/* Functions for the join algorithms       */
+int hash_join(const JoinInput* left, const JoinInput* right, JoinResult* result);
+int parallel_hash_join(const JoinInput* left, const JoinInput* right, JoinResult* result);
+int nested_loop_join(const JoinInput* left, const JoinInput* right, JoinResult* result);
+bool join_input_sorted(const JoinInput* input);
+int merge_join(const JoinInput* left, const JoinInput* right, JoinResult* result);
+int grace_hash_join(const JoinInput* left, const JoinInput* right, const char* spill_dir,
+        size_t memory_budget, JoinResult* result);
+/*******************************************/
+
+#endif
@@ -7,7 +7,14 @@
 char* parse_command(char* query_command, message* send_message, int client, ClientContext* context, CatalogHashtable* variable_pool, Queue* batch_queue);
 int allocate(CatalogHashtable** ht, int size);
 int deallocate(CatalogHashtable* ht);
+CatalogEntry* get(CatalogHashtable* ht, char* name);
+int put(CatalogHashtable* ht, CatalogEntry value);
+void release_retired(CatalogHashtable* ht);
+void index_orders_clear(void);
 int print_vector(char* name, CatalogHashtable* variable_pool);
-int print_column(char* name);
-void queue_init(Queue* queue);
+int print_column(char* name, CatalogHashtable* variable_pool);
+ColumnFile* open_binary_column(char* colname, CatalogHashtable* variable_pool);
+int read_column_header(char* colname, ColumnHeader* header);
+void select_binary_range(ColumnFile* bin, int ilow, int ihigh, uint64_t* bitmap, int start, int end);
+void select_morsel(void* arg, int start, int end);
 #endif
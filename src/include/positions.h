@@ -0,0 +1,32 @@
+/**
+ * Contains function definitions for the position
+ * results (bitmaps and position lists) of selects.
+ **/
+
+#ifndef POSITIONS_H
+#define POSITIONS_H
+
+#include "cs165_api.h"
+
+// a select result is kept as a position list when fewer than one in
+// POSITION_LIST_RATIO rows qualify (a list entry costs 32 bits, a row 1)
+#define POSITION_LIST_RATIO 32
+
+/*******************************************/
+/* Functions for building position results */
+void bitmap_set_range(uint64_t* bitmap, int start, int end);
+int bitmap_count(const uint64_t* bitmap, int num_rows);
+void positions_from_bitmap(CatalogEntry* cat, uint64_t* bitmap, int num_rows);
+void positions_from_list(CatalogEntry* cat, int* list, int count, int num_rows);
+void positions_from_markers(CatalogEntry* cat);
+void positions_from_join(CatalogEntry* cat, int* list, int count, int num_rows);
+/*******************************************/
+
+/*******************************************/
+/* Functions for reading position results  */
+bool is_position_result(const CatalogEntry* cat);
+void position_cursor_init(PositionCursor* cursor, const CatalogEntry* cat);
+int position_cursor_next(PositionCursor* cursor);
+/*******************************************/
+
+#endif
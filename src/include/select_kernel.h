@@ -0,0 +1,19 @@
+/**
+ * Contains function definitions for the
+ * vectorized range-select kernels.
+ **/
+
+#ifndef SELECT_KERNEL_H
+#define SELECT_KERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************/
+/* Functions for evaluating lo <= v < hi   */
+const char* select_kernel_name(void);
+size_t select_range_bitmap(const int* values, size_t n, int lo, int hi, uint64_t* bitmap);
+size_t select_range_positions(const int* values, size_t n, int lo, int hi, int base, int* positions);
+/*******************************************/
+
+#endif
@@ -0,0 +1,21 @@
+/**
+ * Contains function definitions for the
+ * scans shared between concurrent selects.
+ **/
+
+#ifndef SHARED_SCAN_H
+#define SHARED_SCAN_H
+
+#include "cs165_api.h"
+#include "thread_pool.h"
+
+// rows a shared scan moves through at a time; a select that arrives while a
+// scan of its column is running starts with the scan's next chunk
+#define SHARED_SCAN_CHUNK (16 * MORSEL_SIZE)
+
+/*******************************************/
+/* Functions for running shared scans      */
+int shared_scan_select(const SelectOperator* select, uint64_t* bitmap);
+/*******************************************/
+
+#endif
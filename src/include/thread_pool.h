@@ -0,0 +1,35 @@
+/**
+ * Contains function definitions for the
+ * server-wide worker thread pool.
+ **/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "cs165_api.h"
+
+// number of rows handed to a worker at a time
+#define MORSEL_SIZE 16384
+
+/*******************************************/
+/* Functions for the per-worker queues     */
+void queue_init(Queue* queue);
+void queue_push_tail(Queue* queue, node_t* node);
+node_t* queue_pop_tail(Queue* queue);
+node_t* queue_steal_head(Queue* queue);
+node_t* queue_steal_job(Queue* queue, const MorselJob* job);
+/*******************************************/
+
+/*******************************************/
+/* Functions for starting/stopping workers */
+int thread_pool_init(int num_threads);
+void thread_pool_destroy(void);
+int thread_pool_size(void);
+/*******************************************/
+
+/*******************************************/
+/* Functions for running parallel work     */
+void thread_pool_run(MorselFunction func, void* arg, int start, int end, int morsel_size);
+/*******************************************/
+
+#endif
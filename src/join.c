@@ -0,0 +1,865 @@
+/**
+ * Contains all functionality for joins.
+ *
+ * A join takes two (value vector, position vector) pairs, as produced by
+ * fetch and select, and returns the pairs of rows whose values are equal as
+ * two aligned position lists that fetch can read.
+ *
+ * The hash join is radix partitioned: both inputs are first scattered into
+ * partitions by the top bits of the key hash, sized so that one build
+ * partition and its hash table fit in cache, and the partitions are then
+ * joined one at a time. Without partitioning every build insert and probe
+ * would be a cache miss once the build side outgrows the cache.
+ *
+ * With more than one worker, large hash joins run on the thread pool: every
+ * morsel of an input counts and then scatters its own tuples into the
+ * partitions at offsets worked out beforehand, and the partitions are joined
+ * by different workers into results of their own, which are concatenated at
+ * the end. Workers never write to the same place, so no locks are needed.
+ *
+ * The nested-loop join is blocked: a block of the outer input that fits in L2
+ * is compared against one L1 sized tile of the inner input at a time, and
+ * each outer value is matched against the whole tile with the SIMD select
+ * kernel, so equal values come out as a bitmap instead of one branch per pair.
+ *
+ * When the inputs are larger than the join's memory budget, the grace hash
+ * join first scatters both of them into partition files on disk and then
+ * hash joins one pair of partitions at a time, so only one pair needs to be
+ * in memory at once.
+ *
+ * The merge join takes inputs that are already in key order, as read from a
+ * sorted column or walked out of a sorted or B+tree index, and joins them in
+ * one sequential pass without hashing or sorting.
+ **/
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "join.h"
+#include "select_kernel.h"
+#include "utils.h"
+
+/**
+ * JoinTuple
+ * A (key, row) pair as scattered into a partition.
+ **/
+typedef struct JoinTuple {
+    int key;
+    int pos;
+} JoinTuple;
+
+
+int join_result_init(JoinResult* result, int capacity) {
+    if (capacity < 1) {
+        capacity = 1;
+    }
+    result->left = malloc(capacity * sizeof(int));
+    result->right = malloc(capacity * sizeof(int));
+    if (!result->left || !result->right) {
+        perror("Memory allocation failed");
+        free(result->left);
+        free(result->right);
+        result->left = NULL;
+        result->right = NULL;
+        return -1;
+    }
+    result->count = 0;
+    result->capacity = capacity;
+    return 0;
+}
+
+int join_result_append(JoinResult* result, int left, int right) {
+    if (result->count == result->capacity) {
+        int* left_copy = realloc(result->left, result->capacity * 2 * sizeof(int));
+        if (!left_copy) {
+            perror("Allocation failure");
+            return -1;
+        }
+        result->left = left_copy;
+        int* right_copy = realloc(result->right, result->capacity * 2 * sizeof(int));
+        if (!right_copy) {
+            perror("Allocation failure");
+            return -1;
+        }
+        result->right = right_copy;
+        result->capacity *= 2;
+    }
+    result->left[result->count] = left;
+    result->right[result->count] = right;
+    result->count++;
+    return 0;
+}
+
+/**
+ * Make room for n more pairs in result.
+ **/
+static int join_result_reserve(JoinResult* result, int n) {
+    if (result->count + n <= result->capacity) {
+        return 0;
+    }
+    int capacity = result->count + n;
+    int* left_copy = realloc(result->left, capacity * sizeof(int));
+    if (!left_copy) {
+        perror("Allocation failure");
+        return -1;
+    }
+    result->left = left_copy;
+    int* right_copy = realloc(result->right, capacity * sizeof(int));
+    if (!right_copy) {
+        perror("Allocation failure");
+        return -1;
+    }
+    result->right = right_copy;
+    result->capacity = capacity;
+    return 0;
+}
+
+void join_result_free(JoinResult* result) {
+    free(result->left);
+    free(result->right);
+    result->left = NULL;
+    result->right = NULL;
+    result->count = 0;
+    result->capacity = 0;
+}
+
+static inline unsigned int join_hash(int key) {
+    // Fibonacci hashing: the high bits pick the partition, the low bits the bucket
+    return (unsigned int) key * 2654435761u;
+}
+
+/**
+ * Fewest radix bits that bring a build side of count tuples down to about
+ * JOIN_PARTITION_TUPLES per partition.
+ **/
+static int radix_bits(int count) {
+    int bits = 0;
+    while (bits < JOIN_MAX_RADIX_BITS && (count >> bits) > JOIN_PARTITION_TUPLES) {
+        bits++;
+    }
+    return bits;
+}
+
+static inline int partition_of(unsigned int hash, int bits) {
+    return bits == 0 ? 0 : (int) (hash >> (32 - bits));
+}
+
+/**
+ * Scatters input into out by partition. offsets (2^bits + 1 entries) gets
+ * the start of every partition in out.
+ **/
+static int radix_partition(const JoinInput* input, int bits, JoinTuple* out, int* offsets) {
+    int partitions = 1 << bits;
+    memset(offsets, 0, (partitions + 1) * sizeof(int));
+    for (int i = 0; i < input->count; i++) {
+        offsets[partition_of(join_hash(input->values[i]), bits) + 1]++;
+    }
+    for (int p = 0; p < partitions; p++) {
+        offsets[p + 1] += offsets[p];
+    }
+    int* cursor = malloc(partitions * sizeof(int));
+    if (!cursor) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    memcpy(cursor, offsets, partitions * sizeof(int));
+    for (int i = 0; i < input->count; i++) {
+        int p = partition_of(join_hash(input->values[i]), bits);
+        out[cursor[p]].key = input->values[i];
+        out[cursor[p]].pos = input->positions[i];
+        cursor[p]++;
+    }
+    free(cursor);
+    return 0;
+}
+
+/**
+ * Joins build[0, build_count) with probe[0, probe_count) through a chained
+ * hash table held in head (buckets entries, a power of two) and next.
+ * build_is_left says which side of the result the build rows go to.
+ **/
+static int join_partition(const JoinTuple* build, int build_count, const JoinTuple* probe, int probe_count,
+        int* head, int* next, int buckets, bool build_is_left, JoinResult* result) {
+    if (build_count == 0 || probe_count == 0) {
+        return 0;
+    }
+    unsigned int mask = buckets - 1;
+    for (int b = 0; b < buckets; b++) {
+        head[b] = -1;
+    }
+    for (int i = 0; i < build_count; i++) {
+        unsigned int bucket = join_hash(build[i].key) & mask;
+        next[i] = head[bucket];
+        head[bucket] = i;
+    }
+    for (int i = 0; i < probe_count; i++) {
+        int key = probe[i].key;
+        for (int j = head[join_hash(key) & mask]; j != -1; j = next[j]) {
+            if (build[j].key != key) {
+                continue;
+            }
+            int ret = build_is_left
+                ? join_result_append(result, build[j].pos, probe[i].pos)
+                : join_result_append(result, probe[i].pos, build[j].pos);
+            if (ret != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Equi-join of left and right through a radix partitioned hash join, with
+ * the smaller input as the build side. result must be initialized.
+ **/
+int hash_join(const JoinInput* left, const JoinInput* right, JoinResult* result) {
+    bool build_is_left = left->count <= right->count;
+    const JoinInput* build = build_is_left ? left : right;
+    const JoinInput* probe = build_is_left ? right : left;
+    if (build->count == 0) {
+        return 0;
+    }
+
+    int bits = radix_bits(build->count);
+    int partitions = 1 << bits;
+    JoinTuple* build_parts = malloc(build->count * sizeof(JoinTuple));
+    JoinTuple* probe_parts = malloc((probe->count > 0 ? probe->count : 1) * sizeof(JoinTuple));
+    int* build_offsets = malloc((partitions + 1) * sizeof(int));
+    int* probe_offsets = malloc((partitions + 1) * sizeof(int));
+    if (!build_parts || !probe_parts || !build_offsets || !probe_offsets) {
+        perror("Memory allocation failed");
+        free(build_parts);
+        free(probe_parts);
+        free(build_offsets);
+        free(probe_offsets);
+        return -1;
+    }
+    int ret = 0;
+    if (radix_partition(build, bits, build_parts, build_offsets) != 0
+            || radix_partition(probe, bits, probe_parts, probe_offsets) != 0) {
+        ret = -1;
+    }
+
+    // one hash table, sized for the largest build partition, serves them all
+    int largest = 0;
+    for (int p = 0; ret == 0 && p < partitions; p++) {
+        int size = build_offsets[p + 1] - build_offsets[p];
+        largest = size > largest ? size : largest;
+    }
+    int buckets = 1;
+    while (buckets < largest) {
+        buckets <<= 1;
+    }
+    int* head = malloc(buckets * sizeof(int));
+    int* next = malloc((largest > 0 ? largest : 1) * sizeof(int));
+    if (ret == 0 && (!head || !next)) {
+        perror("Memory allocation failed");
+        ret = -1;
+    }
+    for (int p = 0; ret == 0 && p < partitions; p++) {
+        int build_count = build_offsets[p + 1] - build_offsets[p];
+        // a small partition gets a small table so clearing it stays cheap
+        int partition_buckets = 1;
+        while (partition_buckets < build_count) {
+            partition_buckets <<= 1;
+        }
+        ret = join_partition(build_parts + build_offsets[p], build_count,
+                probe_parts + probe_offsets[p], probe_offsets[p + 1] - probe_offsets[p],
+                head, next, partition_buckets, build_is_left, result);
+    }
+
+    free(head);
+    free(next);
+    free(build_parts);
+    free(probe_parts);
+    free(build_offsets);
+    free(probe_offsets);
+    return ret;
+}
+
+/**
+ * PartitionJob
+ * A radix partitioning of input run on the thread pool. cursors holds a
+ * row of 2^bits partition counts per morsel of input, which become the
+ * offsets in out each morsel scatters its tuples to.
+ **/
+typedef struct PartitionJob {
+    const JoinInput* input;
+    int bits;
+    int* cursors;
+    JoinTuple* out;
+} PartitionJob;
+
+static void histogram_morsel(void* arg, int start, int end) {
+    PartitionJob* job = arg;
+    int* counts = job->cursors + (size_t) (start / MORSEL_SIZE) * (1 << job->bits);
+    for (int i = start; i < end; i++) {
+        counts[partition_of(join_hash(job->input->values[i]), job->bits)]++;
+    }
+}
+
+static void scatter_morsel(void* arg, int start, int end) {
+    PartitionJob* job = arg;
+    int* cursor = job->cursors + (size_t) (start / MORSEL_SIZE) * (1 << job->bits);
+    for (int i = start; i < end; i++) {
+        int p = partition_of(join_hash(job->input->values[i]), job->bits);
+        job->out[cursor[p]].key = job->input->values[i];
+        job->out[cursor[p]].pos = job->input->positions[i];
+        cursor[p]++;
+    }
+}
+
+/**
+ * radix_partition on the thread pool. Within a partition tuples keep the
+ * order of input, as every morsel's share follows the one before it.
+ **/
+static int parallel_radix_partition(const JoinInput* input, int bits, JoinTuple* out, int* offsets) {
+    int partitions = 1 << bits;
+    int num_morsels = (input->count + MORSEL_SIZE - 1) / MORSEL_SIZE;
+    PartitionJob job;
+    job.input = input;
+    job.bits = bits;
+    job.out = out;
+    job.cursors = calloc((size_t) (num_morsels > 0 ? num_morsels : 1) * partitions, sizeof(int));
+    if (!job.cursors) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    thread_pool_run(histogram_morsel, &job, 0, input->count, MORSEL_SIZE);
+    int sum = 0;
+    for (int p = 0; p < partitions; p++) {
+        offsets[p] = sum;
+        for (int m = 0; m < num_morsels; m++) {
+            int* count = &job.cursors[(size_t) m * partitions + p];
+            int c = *count;
+            *count = sum;
+            sum += c;
+        }
+    }
+    offsets[partitions] = sum;
+    thread_pool_run(scatter_morsel, &job, 0, input->count, MORSEL_SIZE);
+    free(job.cursors);
+    return 0;
+}
+
+/**
+ * ProbeJob
+ * The partitions of a parallel hash join; every partition is joined into
+ * its own entry of results.
+ **/
+typedef struct ProbeJob {
+    const JoinTuple* build_parts;
+    const int* build_offsets;
+    const JoinTuple* probe_parts;
+    const int* probe_offsets;
+    bool build_is_left;
+    JoinResult* results;
+    int* result_offsets;
+    JoinResult* result;
+    int failed;
+} ProbeJob;
+
+static void join_morsel(void* arg, int start, int end) {
+    ProbeJob* job = arg;
+    int largest = 1;
+    for (int p = start; p < end; p++) {
+        int size = job->build_offsets[p + 1] - job->build_offsets[p];
+        largest = size > largest ? size : largest;
+    }
+    int buckets = 1;
+    while (buckets < largest) {
+        buckets <<= 1;
+    }
+    int* head = malloc(buckets * sizeof(int));
+    int* next = malloc(largest * sizeof(int));
+    if (!head || !next) {
+        perror("Memory allocation failed");
+        __sync_fetch_and_or(&job->failed, 1);
+    }
+    for (int p = start; p < end && head && next; p++) {
+        int build_count = job->build_offsets[p + 1] - job->build_offsets[p];
+        int probe_count = job->probe_offsets[p + 1] - job->probe_offsets[p];
+        int partition_buckets = 1;
+        while (partition_buckets < build_count) {
+            partition_buckets <<= 1;
+        }
+        if (join_result_init(&job->results[p], probe_count) != 0
+                || join_partition(job->build_parts + job->build_offsets[p], build_count,
+                    job->probe_parts + job->probe_offsets[p], probe_count,
+                    head, next, partition_buckets, job->build_is_left, &job->results[p]) != 0) {
+            __sync_fetch_and_or(&job->failed, 1);
+        }
+    }
+    free(head);
+    free(next);
+}
+
+static void gather_morsel(void* arg, int start, int end) {
+    ProbeJob* job = arg;
+    for (int p = start; p < end; p++) {
+        int offset = job->result->count + job->result_offsets[p];
+        memcpy(job->result->left + offset, job->results[p].left, job->results[p].count * sizeof(int));
+        memcpy(job->result->right + offset, job->results[p].right, job->results[p].count * sizeof(int));
+    }
+}
+
+/**
+ * hash_join on the thread pool: both inputs are partitioned in parallel and
+ * the partitions are joined by different workers, so that it scales with
+ * the workers rather than being bound to one core. Small joins, or a pool
+ * of one, run hash_join itself. result must be initialized.
+ **/
+int parallel_hash_join(const JoinInput* left, const JoinInput* right, JoinResult* result) {
+    int workers = thread_pool_size();
+    if (workers < 2 || left->count + right->count < JOIN_PARALLEL_MIN_TUPLES) {
+        return hash_join(left, right, result);
+    }
+    bool build_is_left = left->count <= right->count;
+    const JoinInput* build = build_is_left ? left : right;
+    const JoinInput* probe = build_is_left ? right : left;
+    if (build->count == 0) {
+        return 0;
+    }
+
+    int bits = radix_bits(build->count);
+    while (bits < JOIN_MAX_RADIX_BITS && (1 << bits) < workers * JOIN_PARTITIONS_PER_WORKER) {
+        bits++;
+    }
+    int partitions = 1 << bits;
+    ProbeJob job;
+    job.build_is_left = build_is_left;
+    job.result = result;
+    job.failed = 0;
+    JoinTuple* build_parts = malloc(build->count * sizeof(JoinTuple));
+    JoinTuple* probe_parts = malloc((probe->count > 0 ? probe->count : 1) * sizeof(JoinTuple));
+    int* build_offsets = malloc((partitions + 1) * sizeof(int));
+    int* probe_offsets = malloc((partitions + 1) * sizeof(int));
+    job.results = calloc(partitions, sizeof(JoinResult));
+    job.result_offsets = malloc((partitions + 1) * sizeof(int));
+    int ret = 0;
+    if (!build_parts || !probe_parts || !build_offsets || !probe_offsets || !job.results || !job.result_offsets) {
+        perror("Memory allocation failed");
+        ret = -1;
+    }
+    if (ret == 0 && (parallel_radix_partition(build, bits, build_parts, build_offsets) != 0
+            || parallel_radix_partition(probe, bits, probe_parts, probe_offsets) != 0)) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        job.build_parts = build_parts;
+        job.build_offsets = build_offsets;
+        job.probe_parts = probe_parts;
+        job.probe_offsets = probe_offsets;
+        thread_pool_run(join_morsel, &job, 0, partitions, JOIN_PARTITIONS_PER_MORSEL);
+        ret = job.failed ? -1 : 0;
+    }
+    if (ret == 0) {
+        // every partition's pairs go to their own slice of result
+        job.result_offsets[0] = 0;
+        for (int p = 0; p < partitions; p++) {
+            job.result_offsets[p + 1] = job.result_offsets[p] + job.results[p].count;
+        }
+        ret = join_result_reserve(result, job.result_offsets[partitions]);
+    }
+    if (ret == 0) {
+        thread_pool_run(gather_morsel, &job, 0, partitions, JOIN_PARTITIONS_PER_MORSEL);
+        result->count += job.result_offsets[partitions];
+    }
+
+    for (int p = 0; job.results != NULL && p < partitions; p++) {
+        join_result_free(&job.results[p]);
+    }
+    free(job.results);
+    free(job.result_offsets);
+    free(build_parts);
+    free(probe_parts);
+    free(build_offsets);
+    free(probe_offsets);
+    return ret;
+}
+
+/**
+ * Appends outer_pos paired with every row of the inner tile whose value is
+ * key. Equality is the range [key, key + 1), so the select kernel does the
+ * comparing.
+ **/
+static int match_tile(int key, int outer_pos, const JoinInput* inner, int start, int end,
+        bool outer_is_left, JoinResult* result) {
+    uint64_t bitmap[JOIN_INNER_TILE / 64];
+    int n = end - start;
+    if (key == INT_MAX) {
+        // key + 1 would overflow
+        memset(bitmap, 0, ((n + 63) / 64) * sizeof(uint64_t));
+        for (int i = 0; i < n; i++) {
+            if (inner->values[start + i] == key) {
+                bitmap[i / 64] |= 1ULL << (i % 64);
+            }
+        }
+    } else if (select_range_bitmap(inner->values + start, n, key, key + 1, bitmap) == 0) {
+        return 0;
+    }
+    for (int w = 0; w * 64 < n; w++) {
+        uint64_t bits = bitmap[w];
+        while (bits) {
+            int inner_pos = inner->positions[start + w * 64 + __builtin_ctzll(bits)];
+            bits &= bits - 1;
+            int ret = outer_is_left
+                ? join_result_append(result, outer_pos, inner_pos)
+                : join_result_append(result, inner_pos, outer_pos);
+            if (ret != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Equi-join of left and right by a block nested-loop join, for inputs small
+ * enough that hashing them is not worth it. The smaller input is the inner
+ * one, cut into JOIN_INNER_TILE tiles; the outer one is read in
+ * JOIN_OUTER_BLOCK blocks. result must be initialized.
+ **/
+int nested_loop_join(const JoinInput* left, const JoinInput* right, JoinResult* result) {
+    bool outer_is_left = left->count >= right->count;
+    const JoinInput* outer = outer_is_left ? left : right;
+    const JoinInput* inner = outer_is_left ? right : left;
+
+    for (int block = 0; block < outer->count; block += JOIN_OUTER_BLOCK) {
+        int block_end = block + JOIN_OUTER_BLOCK < outer->count ? block + JOIN_OUTER_BLOCK : outer->count;
+        for (int tile = 0; tile < inner->count; tile += JOIN_INNER_TILE) {
+            int tile_end = tile + JOIN_INNER_TILE < inner->count ? tile + JOIN_INNER_TILE : inner->count;
+            for (int i = block; i < block_end; i++) {
+                if (match_tile(outer->values[i], outer->positions[i], inner, tile, tile_end,
+                        outer_is_left, result) != 0) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * True if input's values are in ascending order, so it can be merged as is.
+ **/
+bool join_input_sorted(const JoinInput* input) {
+    for (int i = 1; i < input->count; i++) {
+        if (input->values[i] < input->values[i - 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Equi-join of left and right, both in ascending value order, in a single
+ * merge pass. A run of equal keys on one side is joined with the whole run
+ * on the other. result must be initialized.
+ **/
+int merge_join(const JoinInput* left, const JoinInput* right, JoinResult* result) {
+    int i = 0;
+    int j = 0;
+    while (i < left->count && j < right->count) {
+        int key = left->values[i];
+        if (key < right->values[j]) {
+            i++;
+            continue;
+        }
+        if (key > right->values[j]) {
+            j++;
+            continue;
+        }
+        int left_end = i + 1;
+        while (left_end < left->count && left->values[left_end] == key) {
+            left_end++;
+        }
+        int right_end = j + 1;
+        while (right_end < right->count && right->values[right_end] == key) {
+            right_end++;
+        }
+        for (int l = i; l < left_end; l++) {
+            for (int r = j; r < right_end; r++) {
+                if (join_result_append(result, left->positions[l], right->positions[r]) != 0) {
+                    return -1;
+                }
+            }
+        }
+        i = left_end;
+        j = right_end;
+    }
+    return 0;
+}
+
+// bytes of working memory hash_join needs per input tuple: the input itself,
+// its partitioned copy and, on the build side, the hash table
+#define JOIN_TUPLE_BYTES (2 * sizeof(int) + sizeof(JoinTuple) + 2 * sizeof(int))
+
+/**
+ * JoinSource
+ * One side of a grace hash join: the input in memory, or a partition of it
+ * spilled to file (count tuples).
+ **/
+typedef struct JoinSource {
+    const JoinInput* input;
+    FILE* file;
+    int count;
+} JoinSource;
+
+/**
+ * Hash that picks the spill partition. It is salted by the pass, so that a
+ * partition split again does not land in a single partition once more, and
+ * is independent of the bits hash_join partitions and buckets by.
+ **/
+static inline unsigned int spill_hash(int key, int depth) {
+    unsigned int h = (unsigned int) key ^ (0x9E3779B9u * (unsigned int) (depth + 1));
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+/**
+ * Anonymous temporary file in dir, removed again once it is closed.
+ **/
+static FILE* spill_file(const char* dir) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/join_XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("Unable to create join spill file");
+        return NULL;
+    }
+    unlink(path);
+    FILE* file = fdopen(fd, "w+b");
+    if (file == NULL) {
+        perror("Unable to open join spill file");
+        close(fd);
+    }
+    return file;
+}
+
+/**
+ * Reads up to n tuples of source, starting at tuple offset, into out.
+ **/
+static int source_read(JoinSource* source, int offset, JoinTuple* out, int n) {
+    if (offset + n > source->count) {
+        n = source->count - offset;
+    }
+    if (source->file != NULL) {
+        return (int) fread(out, sizeof(JoinTuple), n, source->file);
+    }
+    for (int i = 0; i < n; i++) {
+        out[i].key = source->input->values[offset + i];
+        out[i].pos = source->input->positions[offset + i];
+    }
+    return n;
+}
+
+/**
+ * Loads a spilled source into input (which the caller frees) for hash_join.
+ **/
+static int source_load(JoinSource* source, JoinInput* input) {
+    int n = source->count > 0 ? source->count : 1;
+    input->values = malloc(n * sizeof(int));
+    input->positions = malloc(n * sizeof(int));
+    JoinTuple* batch = malloc(JOIN_SPILL_BATCH * sizeof(JoinTuple));
+    if (!input->values || !input->positions || !batch) {
+        perror("Memory allocation failed");
+        free(input->values);
+        free(input->positions);
+        free(batch);
+        return -1;
+    }
+    rewind(source->file);
+    int count = 0;
+    while (count < source->count) {
+        int read = source_read(source, count, batch, JOIN_SPILL_BATCH);
+        if (read <= 0) {
+            log_err("Join spill file is short\n");
+            break;
+        }
+        for (int i = 0; i < read; i++) {
+            input->values[count + i] = batch[i].key;
+            input->positions[count + i] = batch[i].pos;
+        }
+        count += read;
+    }
+    free(batch);
+    input->count = count;
+    return count == source->count ? 0 : -1;
+}
+
+/**
+ * Scatters source into the partition files files[0, partitions), counting
+ * the tuples written to each in counts.
+ **/
+static int spill_partition(JoinSource* source, int depth, int partitions, FILE** files, int* counts) {
+    JoinTuple* buffers = malloc((size_t) partitions * JOIN_SPILL_BATCH * sizeof(JoinTuple));
+    int* fill = calloc(partitions, sizeof(int));
+    JoinTuple* batch = malloc(JOIN_SPILL_BATCH * sizeof(JoinTuple));
+    if (!buffers || !fill || !batch) {
+        perror("Memory allocation failed");
+        free(buffers);
+        free(fill);
+        free(batch);
+        return -1;
+    }
+    if (source->file != NULL) {
+        rewind(source->file);
+    }
+    int ret = 0;
+    for (int offset = 0; ret == 0 && offset < source->count; ) {
+        int read = source_read(source, offset, batch, JOIN_SPILL_BATCH);
+        if (read <= 0) {
+            log_err("Join spill file is short\n");
+            ret = -1;
+            break;
+        }
+        offset += read;
+        for (int i = 0; ret == 0 && i < read; i++) {
+            int p = spill_hash(batch[i].key, depth) & (partitions - 1);
+            JoinTuple* buffer = buffers + (size_t) p * JOIN_SPILL_BATCH;
+            buffer[fill[p]++] = batch[i];
+            if (fill[p] == JOIN_SPILL_BATCH) {
+                if (fwrite(buffer, sizeof(JoinTuple), JOIN_SPILL_BATCH, files[p]) != JOIN_SPILL_BATCH) {
+                    perror("Unable to write join spill file");
+                    ret = -1;
+                }
+                counts[p] += JOIN_SPILL_BATCH;
+                fill[p] = 0;
+            }
+        }
+    }
+    for (int p = 0; ret == 0 && p < partitions; p++) {
+        if (fwrite(buffers + (size_t) p * JOIN_SPILL_BATCH, sizeof(JoinTuple), fill[p], files[p]) != (size_t) fill[p]) {
+            perror("Unable to write join spill file");
+            ret = -1;
+        }
+        counts[p] += fill[p];
+    }
+    free(buffers);
+    free(fill);
+    free(batch);
+    return ret;
+}
+
+/**
+ * Most partitions a pass may spill to. A pass keeps its 2 * partitions
+ * files open while it joins them pair by pair, so passes that split a
+ * partition again hold the files of every pass above them too: each of
+ * the JOIN_MAX_SPILL_DEPTH passes gets an equal share of the open file
+ * limit, less JOIN_RESERVED_FILES.
+ **/
+static int spill_partition_limit(void) {
+    long files = 1024;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        files = limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > LONG_MAX ? LONG_MAX : (long) limit.rlim_cur;
+    }
+    long per_pass = (files - JOIN_RESERVED_FILES) / JOIN_MAX_SPILL_DEPTH / 2;
+    int partitions = 2;
+    while (partitions < JOIN_MAX_SPILL_PARTITIONS && 2L * partitions <= per_pass) {
+        partitions <<= 1;
+    }
+    return partitions;
+}
+
+static int grace_join(JoinSource* left, JoinSource* right, const char* spill_dir, size_t memory_budget,
+        int depth, JoinResult* result) {
+    size_t bytes = ((size_t) left->count + right->count) * JOIN_TUPLE_BYTES;
+    if (bytes <= memory_budget || depth == JOIN_MAX_SPILL_DEPTH || left->count == 0 || right->count == 0) {
+        if (bytes > memory_budget && left->count > 0 && right->count > 0) {
+            log_info("Join partition of %d x %d tuples is over budget after %d passes\n",
+                left->count, right->count, depth);
+        }
+        if (left->file == NULL && right->file == NULL) {
+            return parallel_hash_join(left->input, right->input, result);
+        }
+        JoinInput left_input;
+        JoinInput right_input;
+        if (source_load(left, &left_input) != 0) {
+            return -1;
+        }
+        if (source_load(right, &right_input) != 0) {
+            free(left_input.values);
+            free(left_input.positions);
+            return -1;
+        }
+        int ret = parallel_hash_join(&left_input, &right_input, result);
+        free(left_input.values);
+        free(left_input.positions);
+        free(right_input.values);
+        free(right_input.positions);
+        return ret;
+    }
+
+    // enough partitions that a pair of them fits in the budget
+    int max_partitions = spill_partition_limit();
+    int partitions = 2;
+    while (partitions < max_partitions && bytes / partitions > memory_budget) {
+        partitions <<= 1;
+    }
+    FILE** files = calloc(2 * partitions, sizeof(FILE*));
+    int* counts = calloc(2 * partitions, sizeof(int));
+    if (!files || !counts) {
+        perror("Memory allocation failed");
+        free(files);
+        free(counts);
+        return -1;
+    }
+    int ret = 0;
+    for (int f = 0; ret == 0 && f < 2 * partitions; f++) {
+        files[f] = spill_file(spill_dir);
+        ret = files[f] == NULL ? -1 : 0;
+    }
+    if (ret == 0) {
+        ret = spill_partition(left, depth, partitions, files, counts);
+    }
+    if (ret == 0) {
+        ret = spill_partition(right, depth, partitions, files + partitions, counts + partitions);
+    }
+    for (int p = 0; ret == 0 && p < partitions; p++) {
+        JoinSource left_part = { NULL, files[p], counts[p] };
+        JoinSource right_part = { NULL, files[partitions + p], counts[partitions + p] };
+        ret = grace_join(&left_part, &right_part, spill_dir, memory_budget, depth + 1, result);
+        // a joined pair is not needed again; give its files back before the next
+        fclose(files[p]);
+        fclose(files[partitions + p]);
+        files[p] = NULL;
+        files[partitions + p] = NULL;
+    }
+    for (int f = 0; f < 2 * partitions; f++) {
+        if (files[f] != NULL) {
+            fclose(files[f]);
+        }
+    }
+    free(files);
+    free(counts);
+    return ret;
+}
+
+/**
+ * Equi-join of left and right that keeps its working memory within
+ * memory_budget bytes. Inputs that fit are hash joined directly; otherwise
+ * both are hash partitioned into temporary files in spill_dir, and each pair
+ * of partitions is joined in turn, split again if it still does not fit.
+ * The budget does not cover left and right themselves, which the caller
+ * holds in memory throughout, nor result, which grows with the matches.
+ * result must be initialized.
+ **/
+int grace_hash_join(const JoinInput* left, const JoinInput* right, const char* spill_dir,
+        size_t memory_budget, JoinResult* result) {
+    JoinSource left_source = { left, NULL, left->count };
+    JoinSource right_source = { right, NULL, right->count };
+    return grace_join(&left_source, &right_source, spill_dir, memory_budget, 0, result);
+}
@@ -17,6 +17,18 @@
 #include "utils.h"
 #include "client_context.h"
 #include "bplus.h"
+#include "column_file.h"
+#include "thread_pool.h"
+#include "select_kernel.h"
+#include "positions.h"
+#include "db_operator.h"
+#include "join.h"
+#include "bloom.h"
+#include "groupby.h"
+#include "aggregate.h"
+#include "arith_kernel.h"
+#include "async_batch.h"
+#include "batch_select.h"
 
 
 #include <stdio.h>
@@ -28,6 +40,7 @@
 #include <errno.h>
 #include <dirent.h>
 #include <limits.h>
+#include <math.h>
 #include <pthread.h>
 #define MAX_LINE_SIZE 1024
 #define DELIMITER ","
@@ -35,10 +48,14 @@
 
 #define MAX_THREADS 4
 #define TASK_QUEUE_SIZE 10
+// index orders kept loaded for batches and joins that walk an index
+#define INDEX_ORDER_CACHE_SIZE 8
 
 char* makePath(char* name, CreateType t);
 int binary_search(int* sorted_data, int num_items, int val);
 void insert_at_pos(int* data, int num_items, int pos, int val);
+CatalogEntry* get_result(CatalogHashtable* variable_pool, char* name);
+int materialize_table_plans(CatalogHashtable* variable_pool, const char* table);
 
 
 /**
@@ -78,7 +95,9 @@ int allocate(CatalogHashtable** ht, int size) {
         for (int i = 0; i < 5003; i++) {
             t.table[i] = (CatalogEntry*) NULL;
         }
+        t.retired = NULL;
         **ht = t;
+        pthread_mutex_init(&(*ht)->mutex, NULL);
         // At this point ht should be a block of memory for a hashtable that has all values at null node pointers
         return 0;
     }
@@ -92,6 +111,7 @@ CatalogEntry* get(CatalogHashtable* ht, char* name) {
     if (ht != NULL) {
         int key = hash(name);
         bool found = false;
+        pthread_mutex_lock(&ht->mutex);
         CatalogEntry* target_node_ptr = ht->table[key];
         while (target_node_ptr != NULL && !found) {
             CatalogEntry target = *target_node_ptr;
@@ -103,6 +123,7 @@ CatalogEntry* get(CatalogHashtable* ht, char* name) {
                 target_node_ptr = target.next;
             } 
         }
+        pthread_mutex_unlock(&ht->mutex);
         return (found) ? target_node_ptr : (CatalogEntry*) NULL;
     }
     perror("Hashtable doesnt exist");
@@ -124,34 +145,71 @@ int add_node(CatalogEntry* object_node, CatalogEntry* target_node) {
     return -1;
 }
 
+// HELPER FUNCTION FOR PUT AND ERASE
+// An entry taken out of the table may still be in use by whoever looked it up
+// (another command of an async wave, or the command that replaced it), so it is
+// kept on the retired list until release_retired(). Called with the mutex held.
+static void retire_node(CatalogHashtable* ht, CatalogEntry* node) {
+    node->next = ht->retired;
+    ht->retired = node;
+}
+
+// THIS FREES THE ENTRIES TAKEN OUT OF THE HASHTABLE. ONLY CALL IT WHEN NO
+// COMMAND CAN STILL HOLD A POINTER RETURNED BY get()
+void release_retired(CatalogHashtable* ht) {
+    if (ht == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&ht->mutex);
+    CatalogEntry* node = ht->retired;
+    ht->retired = NULL;
+    pthread_mutex_unlock(&ht->mutex);
+    while (node != NULL) {
+        CatalogEntry* next = node->next;
+        plan_release(node->plan);
+        free(node);
+        node = next;
+    }
+}
+
 // THIS METHOD PUTS A KEY VALUE PAIRING INTO THE HASHTABLE
 int put(CatalogHashtable* ht, CatalogEntry value) {
     // Initialize node
     CatalogEntry* new_node = (CatalogEntry *)calloc(1, sizeof(CatalogEntry));
     *new_node = value;
+    new_node->next = NULL;
 
     if (ht != NULL) {
         int buck = hash(value.name);
+        int ret = 0;
         
-        CatalogHashtable temp = *ht;
-        if (temp.table[buck] == NULL) {
+        pthread_mutex_lock(&ht->mutex);
+        if (ht->table[buck] == NULL) {
             ht->table[buck] = new_node;
-            return 0;
         }
         else {
-            // COLLISION CASE: TODO - FIX. MAYBE OVERCOMMITING? DONT KEEP ADDING TO CATALOGUE?
-            // if need to add a column to the hashtable
-            if (new_node->in_vpool != true) {
-                return add_node(ht->table[buck], new_node);
+            // a variable that is assigned again replaces the entry of the same name,
+            // anything else that hashes to this bucket is chained after the others
+            CatalogEntry** link = &ht->table[buck];
+            if (new_node->in_vpool) {
+                while (*link != NULL && strcmp((*link)->name, value.name) != 0) {
+                    link = &(*link)->next;
+                }
+            }
+            if (new_node->in_vpool && *link != NULL) {
+                CatalogEntry* old_node = *link;
+                new_node->next = old_node->next;
+                *link = new_node;
+                retire_node(ht, old_node);
             }
-            // else if need to replace a repeated variable name 
-            // (TODO: this is actually comparing hashed names. Hopefully wont cause problems)
             else {
-                ht->table[buck] = new_node;
-                return 0;
+                ret = add_node(ht->table[buck], new_node);
             }
         }
-            }
+        pthread_mutex_unlock(&ht->mutex);
+        return ret;
+    }
+    free(new_node);
     return -1;
 }
 // HELPER FUNCTION FOR ERASE
@@ -161,7 +219,6 @@ int changeprev(CatalogEntry** ptr2pres, CatalogEntry* newptr) {
 }
 // HELPER FUNCTION FOR ERASE (may come in handy on its own)
 int removenode(CatalogEntry** current, CatalogEntry** temp, CatalogEntry** previous) {
-    CatalogEntry* current_loc = *temp;
     if (*previous != NULL) {
         (**previous).next = (**temp).next;
         *temp = (**temp).next;
@@ -170,7 +227,6 @@ int removenode(CatalogEntry** current, CatalogEntry** temp, CatalogEntry** previ
         *current = (**current).next;
         *temp = *current;
     }
-    free(current_loc);
     return 0;
 }
 
@@ -474,6 +530,12 @@ int sync_col(CatalogEntry* col) {
     }
     if (col->is_column != NULL && col->is_column == true) {
         int rflag;
+
+        // flush and trim the binary copy of the column
+        if (col->binfile != NULL) {
+            column_file_close(col->binfile);
+            col->binfile = NULL;
+        }
         
         if (col->in_cluster == false) {
             // should have been added to data as regular
@@ -519,6 +581,7 @@ int deallocate_bucket(CatalogEntry* head) {
         temp = head;
         head = head->next;
         sync_col(temp);
+        plan_release(temp->plan);
         free(temp);
     }
     return 0;
@@ -527,18 +590,22 @@ int deallocate_bucket(CatalogEntry* head) {
 int erase(CatalogHashtable* ht, char* name) {
     if (ht != NULL) {
         int key = hash(name);
+        pthread_mutex_lock(&ht->mutex);
         CatalogEntry** curr_node = &ht->table[key];
         CatalogEntry *temp = *curr_node;
         CatalogEntry* prev_node = NULL;
         while (temp != NULL) {
             if (strcmp((*temp).name, name) == 0) {
+                CatalogEntry* removed = temp;
                 removenode(curr_node, &temp, &prev_node);
+                retire_node(ht, removed);
             }
             else {
                 changeprev(&prev_node, temp);
                 temp = (*temp).next;
             }
         }
+        pthread_mutex_unlock(&ht->mutex);
         return 0;
     }
     return -1;
@@ -550,6 +617,8 @@ int deallocate(CatalogHashtable* ht) {
         for (int i=0; i<5003; i++) {
             deallocate_bucket((*ht).table[i]);
         }
+        release_retired(ht);
+        pthread_mutex_destroy(&ht->mutex);
         free(ht);
         return 0;
     }
@@ -571,7 +640,7 @@ CreateType str_to_type(char * t) {
 
 // THIS TAKES A LINE IN THE FILE AND CONVERTS IT TO A CATALOG ENTRY, TO BE APPROPRIATLEY PLACED IN THE HASHTABLE
 CatalogEntry* line_to_entry(char* line, int line_num){
-    CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+    CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
     if (!cat) {
         perror("Failed to allocate memory for CatalogEntry");
         return NULL;
@@ -806,6 +875,12 @@ int add_element_for_load(char* filename, char* val, CatalogHashtable* variable_p
         return -1;
     } 
 
+    // keep the binary copy in step with the text file
+    if (this_table->binfile != NULL && column_file_append(this_table->binfile, atoi(val)) == -1) {
+        perror("Error appending to binary column");
+        return -1;
+    }
+
     char* line = malloc(1024);
     strcpy(line, val);
     strcat(line, "\n");
@@ -1047,6 +1122,14 @@ DbOperator* parse_create_col(char* create_arguments, CatalogEntry* variable_pool
 
     int* data2 = malloc(full_size*sizeof(int));
 
+    // binary copy of the column that queries scan directly
+    ColumnFile* binfile = column_file_create(path);
+    if (binfile == NULL) {
+        munmap(data, full_size);
+        close(fd);
+        return NULL;
+    }
+
     // add memory mapped column to catalogue
 
     CatalogEntry* cat = (CatalogEntry*) calloc(1,sizeof(CatalogEntry)); //FREE
@@ -1059,6 +1142,7 @@ DbOperator* parse_create_col(char* create_arguments, CatalogEntry* variable_pool
     cat->data2 = data2;
     cat->data_size = full_size;
     cat->data2_size=full_size*sizeof(int);
+    cat->binfile = binfile;
     cat->is_column = true;
     cat->has_index = false;
     cat->num_lines = 1;
@@ -1066,6 +1150,10 @@ DbOperator* parse_create_col(char* create_arguments, CatalogEntry* variable_pool
     cat->in_cluster = false;
 
     put(variable_pool, *cat);
+    // the table refers to the hashtable's copy, so that what sync_col does
+    // to it (closing binfile) is seen through the table too
+    free(cat);
+    cat = get(variable_pool, path);
 
     char* table_path = makePath(table_name, _TABLE);
     Tb* curr_table = NULL;
@@ -1365,6 +1453,7 @@ DbOperator* parse_create_idx(char* create_arguments, CatalogEntry* variable_pool
                     col->in_cluster = true;
                     erase(variable_pool, col->name);
                     put(variable_pool, *col);
+                    curr_table->columns[i] = get((CatalogHashtable*) variable_pool, col->name);
                     if (strcmp(curr_table->sort_col_path, col->filepath) == 0) {
                         curr_table->sort_col_index=i;
                     }
@@ -1608,12 +1697,22 @@ DbOperator* parse_insert(char* query_command, message* send_message, CatalogHash
                 perror("Binary search error for binary search");
                 return NULL;
             } 
+            // rows from insert_pos on move, run the plans still reading them
+            if (materialize_table_plans(variable_pool, table_name) == -1) {
+                send_message->status = EXECUTION_ERROR;
+                return NULL;
+            }
             for (int i=0; i<table_obj->col_capacity; i++) {
                 CatalogEntry* current_colt = table_obj->columns[i];
                 CatalogEntry* current_col = get(variable_pool, current_colt->filepath);
    
                 //int insert_pos = get_offset_for_line(current_col->data, insert_line);
                 ins_val = get_nth_string(token,i);
+                if (current_col->binfile != NULL
+                        && column_file_insert_at(current_col->binfile, insert_pos, atoi(ins_val)) == -1) {
+                    send_message->status = EXECUTION_ERROR;
+                    return NULL;
+                }
                 current_col->num_lines++;
                 current_col->offset+=strlen(ins_val) + 1;
                 if (current_col->offset < current_col->data_size) {
@@ -1695,6 +1794,11 @@ DbOperator* parse_insert(char* query_command, message* send_message, CatalogHash
                 char* full_val = malloc(256);
                 strcpy(full_val, ins_val);
                 strcat(full_val,"\n");
+                if (current_col->binfile != NULL && column_file_append(current_col->binfile, atoi(ins_val)) == -1) {
+                    send_message->status = EXECUTION_ERROR;
+                    free(full_val);
+                    return NULL;
+                }
                 current_col->num_lines++;
                 current_col->offset+=strlen(ins_val) + 1;
                 if (current_col->offset < current_col->data_size) {
@@ -1796,6 +1900,272 @@ bool contains_dot(const char *str) {
     return strchr(str, '.') != NULL;
 }
 
+/**
+ * Maps the binary copy of the column db.tbl.col for reading. The row count
+ * comes from the file header, which writers keep current, so this also sees
+ * rows this client has not synced yet.
+ * Returns NULL if the column only exists as a text file.
+ */
+ColumnFile* open_binary_column(char* colname, CatalogHashtable* variable_pool) {
+    (void) variable_pool;
+    char* path = makePath(colname, _COLUMN);
+    if (!path) {
+        return NULL;
+    }
+    ColumnFile* cf = column_file_open(path, false);
+    free(path);
+    return cf;
+}
+
+/**
+ * Reads only the metadata header of the column db.tbl.col.
+ * Returns -1 if the column has no binary file.
+ */
+int read_column_header(char* colname, ColumnHeader* header) {
+    char* path = makePath(colname, _COLUMN);
+    if (!path) {
+        return -1;
+    }
+    int ret = column_file_read_header(path, header);
+    free(path);
+    return ret;
+}
+
+/**
+ * First index in arr[start, end) whose value is >= target (end if none).
+ */
+int lower_bound_range(const int* arr, int start, int end, int target) {
+    int low = start;
+    int high = end;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (arr[mid] < target) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * Evaluates ilow <= v < ihigh over rows [start, end) of a binary column and
+ * sets the bits of the qualifying rows in bitmap, whose bit 0 is row start
+ * and which must start out cleared. start must be a multiple of 64 so that
+ * concurrent callers filling one shared bitmap never share a word.
+ * The column header lets us skip reading values when the range misses or
+ * covers the whole column, and turns the scan into two binary searches when
+ * the column is sorted. Otherwise the zone map is used to do the same per
+ * ZONE_SIZE block, and the remaining blocks go through the SIMD kernel.
+ */
+void select_binary_range(ColumnFile* bin, int ilow, int ihigh, uint64_t* bitmap, int start, int end) {
+    ColumnHeader* header = bin->header;
+    if (ilow >= ihigh || header->row_count == 0 || ihigh <= header->min || ilow > header->max) {
+        return;
+    }
+    if (ilow <= header->min && ihigh > header->max) {
+        bitmap_set_range(bitmap, 0, end - start);
+        return;
+    }
+    if (header->sorted) {
+        int first = lower_bound_range(bin->values, start, end, ilow);
+        int last = lower_bound_range(bin->values, first, end, ihigh);
+        bitmap_set_range(bitmap, first - start, last - start);
+        return;
+    }
+    // walk the zone map a block at a time: blocks that cannot match or match
+    // entirely are decided without reading their values
+    int zones = (int) column_file_zone_count(bin);
+    int i = start;
+    while (i < end) {
+        int zone = i / ZONE_SIZE;
+        int block_end = (zone + 1) * ZONE_SIZE;
+        if (block_end > end) {
+            block_end = end;
+        }
+        if (zone < zones) {
+            ColumnZone* z = &bin->zones[zone];
+            if (ihigh <= z->min || ilow > z->max) {
+                i = block_end;
+                continue;
+            }
+            if (ilow <= z->min && ihigh > z->max) {
+                bitmap_set_range(bitmap, i - start, block_end - start);
+                i = block_end;
+                continue;
+            }
+        }
+        select_range_bitmap(bin->values + i, block_end - i, ilow, ihigh, bitmap + (i - start) / 64);
+        i = block_end;
+    }
+}
+
+
+/**
+ * select(pos, vals, low, high): vals holds the values fetched for the rows of
+ * pos in the same order, so the i-th value belongs to the i-th row of pos.
+ * Builds in cat the rows of pos whose value lies in [ilow, ihigh).
+ */
+void select_from_vectors(CatalogEntry* pvector, CatalogEntry* vvector, int ilow, int ihigh,
+        const BloomFilter* bloom, CatalogEntry* cat) {
+    int* list = malloc((vvector->size > 0 ? vvector->size : 1) * sizeof(int));
+    if (!list) {
+        perror("Memory allocation failed");
+        return;
+    }
+    PositionCursor cursor;
+    position_cursor_init(&cursor, pvector);
+    int count = 0;
+    for (int i = 0; i < vvector->size; i++) {
+        int pos = position_cursor_next(&cursor);
+        if (pos == -1) {
+            break;
+        }
+        int val = vvector->bitvector[i];
+        // always store, only keep it when the value qualifies
+        list[count] = pos;
+        count += (val >= ilow && val < ihigh) && !arith_is_null(vvector->valid, i)
+            && (bloom == NULL || bloom_may_contain(bloom, val));
+    }
+    int num_rows = is_position_result(pvector) ? pvector->num_rows : pvector->size;
+    positions_from_list(cat, list, count, num_rows);
+}
+
+/**
+ * The Bloom filter named by the last argument of a select, or NULL if it
+ * is an ordinary select.
+ */
+BloomFilter* select_bloom_argument(char* query_command, CatalogHashtable* variable_pool) {
+    char* last = strrchr(query_command, ',');
+    if (last == NULL) {
+        return NULL;
+    }
+    char name[MAX_SIZE_NAME];
+    strncpy(name, last + 1, MAX_SIZE_NAME - 1);
+    name[MAX_SIZE_NAME - 1] = '\0';
+    char* close = strchr(name, ')');
+    if (close != NULL) {
+        *close = '\0';
+    }
+    CatalogEntry* entry = get(variable_pool, trim_whitespace(name));
+    return entry != NULL ? entry->bloom : NULL;
+}
+
+/**
+ * select(col,low,high,bf) and select(posvec,valvec,low,high,bf) keep the
+ * rows that are in [low, high) and whose value may also be in the Bloom
+ * filter bf. The filter is tested inside the scan, so rows without a join
+ * partner are dropped before their positions are materialized.
+ */
+DbOperator* parse_select_bloom(char* query_command, char* handle, message* send_message,
+        CatalogHashtable* variable_pool, BloomFilter* bloom, bool parallel) {
+    if (strncmp(query_command, "(", 1) != 0) {
+        send_message->status = UNKNOWN_COMMAND;
+        return NULL;
+    }
+    query_command++;
+    char** command_index = &query_command;
+
+    char* arg1 = next_token(command_index, &send_message->status);
+    char* arg2 = contains_dot(arg1) ? NULL : next_token(command_index, &send_message->status);
+    char* low = next_token(command_index, &send_message->status);
+    char* high = next_token(command_index, &send_message->status);
+    if (!arg1 || !low || !high || (!contains_dot(arg1) && !arg2)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    int ilow = strcmp(low, "null") == 0 ? INT_MIN : atoi(low);
+    int ihigh = strcmp(high, "null") == 0 ? INT_MAX : atoi(high);
+
+    if (contains_dot(arg1)) {
+        ColumnHeader header;
+        if (read_column_header(arg1, &header) != 0) {
+            log_err("Bloom filters only apply to binary columns\n");
+            send_message->status = OBJECT_NOT_FOUND;
+            return NULL;
+        }
+        DbOperator* dbo = calloc(1, sizeof(DbOperator));
+        if (!dbo) {
+            perror("Memory allocation failed");
+            return NULL;
+        }
+        dbo->type = SELECT;
+        SelectOperator* select = &dbo->operator_fields.select_operator;
+        strcpy(select->column, arg1);
+        select->low = ilow;
+        select->high = ihigh;
+        select->num_rows = header.row_count;
+        select->shifts = header.shifts;
+        select->parallel = parallel;
+        select->bloom = bloom;
+        strcpy(dbo->handle, handle);
+        dbo->variable_pool = variable_pool;
+        execute_db_operator(dbo);
+        return dbo;
+    }
+
+    CatalogEntry* pvector = get_result(variable_pool, arg1);
+    CatalogEntry* vvector = get_result(variable_pool, arg2);
+    if (!pvector || !vvector) {
+        log_err("Unknown select input\n");
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+    CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+    if (!cat) {
+        perror("Failed to allocate memory for CatalogEntry");
+        return NULL;
+    }
+    strcpy(cat->name, handle);
+    select_from_vectors(pvector, vvector, ilow, ihigh, bloom, cat);
+    cat->in_vpool = true;
+    put(variable_pool, *cat);
+    free(cat);
+    DbOperator* dbo = malloc(sizeof(DbOperator));
+    return dbo;
+}
+
+/**
+ * bf=bloom(vals) builds a Bloom filter from the values of a fetch, usually
+ * the keys of a join's build side, for selects on the other side to use.
+ */
+DbOperator* parse_bloom(char* query_command, char* handle, message* send_message, CatalogHashtable* variable_pool) {
+    if (strncmp(query_command, "(", 1) != 0) {
+        send_message->status = UNKNOWN_COMMAND;
+        return NULL;
+    }
+    query_command++;
+    char* name = trim_parenthesis(trim_whitespace(query_command));
+    CatalogEntry* vvector = get_result(variable_pool, name);
+    if (!vvector || is_position_result(vvector)) {
+        log_err("bloom needs a value vector\n");
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+    BloomFilter* bloom = bloom_create(vvector->size);
+    if (!bloom) {
+        return NULL;
+    }
+    for (int i = 0; i < vvector->size; i++) {
+        if (!arith_is_null(vvector->valid, i)) {
+            bloom_add(bloom, vvector->bitvector[i]);
+        }
+    }
+
+    CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+    if (!cat) {
+        perror("Failed to allocate memory for CatalogEntry");
+        bloom_free(bloom);
+        return NULL;
+    }
+    strcpy(cat->name, handle);
+    cat->bloom = bloom;
+    cat->in_vpool = true;
+    put(variable_pool, *cat);
+    free(cat);
+    DbOperator* dbo = malloc(sizeof(DbOperator));
+    return dbo;
+}
 
 DbOperator* parse_select(char* query_command, char* handle, message* send_message, CatalogHashtable* variable_pool) {
     if (strncmp(query_command, "(", 1) != 0) {
@@ -1815,12 +2185,6 @@ DbOperator* parse_select(char* query_command, char* handle, message* send_messag
 
         char* fullpath = catpath;
         strcat(fullpath, ".txt");
-        // open column file
-        FILE* file = fopen(fullpath, "r");
-        if (!file) {
-            perror("Error opening file");
-            return NULL;
-            }
 
         char* low = next_token(command_index, &send_message->status);
         char* high = next_token(command_index, &send_message->status);
@@ -1838,6 +2202,37 @@ DbOperator* parse_select(char* query_command, char* handle, message* send_messag
             ihigh = atoi(high);
         }
 
+        // Binary columns are only planned here: the select runs once the
+        // handle is read, or vector by vector under an aggregate
+        ColumnHeader header;
+        if (read_column_header(arg1, &header) == 0) {
+            DbOperator* dbo = calloc(1, sizeof(DbOperator));
+            if (!dbo) {
+                perror("Memory allocation failed");
+                return NULL;
+            }
+            dbo->type = SELECT;
+            SelectOperator* select = &dbo->operator_fields.select_operator;
+            strcpy(select->column, arg1);
+            select->low = ilow;
+            select->high = ihigh;
+            select->num_rows = header.row_count;
+            select->shifts = header.shifts;
+            select->parallel = false;
+            strcpy(dbo->handle, handle);
+            dbo->variable_pool = variable_pool;
+            free(catpath);
+            execute_db_operator(dbo);
+            return dbo;
+        }
+
+        // open column file
+        FILE* file = fopen(fullpath, "r");
+        if (!file) {
+            perror("Error opening file");
+            return NULL;
+            }
+
 
 
         char line[1024];
@@ -1850,7 +2245,7 @@ DbOperator* parse_select(char* query_command, char* handle, message* send_messag
         }
 
 
-        CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+        CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
         if (!cat) {
             perror("Failed to allocate memory for CatalogEntry");
             return NULL;
@@ -1904,55 +2299,45 @@ DbOperator* parse_select(char* query_command, char* handle, message* send_messag
         }
         cat->size = count;
         cat->in_vpool = true;
+        positions_from_markers(cat);
         
         fclose(file);
         put(variable_pool, *cat);
     }
     else {
         // Dealing with pos vector
-        CatalogEntry* pvector = get(variable_pool, arg1);
+        CatalogEntry* pvector = get_result(variable_pool, arg1);
         char* vvector_name = next_token(command_index, &send_message->status);
-        CatalogEntry* vvector = get(variable_pool, vvector_name);
-        int size = pvector->size;
+        CatalogEntry* vvector = get_result(variable_pool, vvector_name);
 
         char* low = next_token(command_index, &send_message->status);
         char* high = next_token(command_index, &send_message->status);
         high = trim_parenthesis(high);
         int ilow;
         int ihigh;
-        if (!low) {
+        if (!low || strcmp(low, "null") == 0) {
             ilow = INT_MIN;
         } else {
             ilow = atoi(low);
         }
-        if (!high) {
+        if (!high || strcmp(high, "null") == 0) {
             ihigh = INT_MAX;
         } else {
             ihigh = atoi(high);
         }
+        if (!pvector || !vvector) {
+            log_err("Unknown select input\n");
+            send_message->status = OBJECT_NOT_FOUND;
+            return NULL;
+        }
 
-        CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+        CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
         if (!cat) {
             perror("Failed to allocate memory for CatalogEntry");
             return NULL;
         }
         strcpy(cat->name, handle);
-        cat->size = size;
-        cat->bitv_capacity = size * sizeof(int);
-        cat->bitvector = (int*) malloc(cat->bitv_capacity);
-
-
-        // assume that both vectors are the same size (one is treated as a bit vector and one as val vector)
-        for (int i=0; i<size; i++) {
-            int val;
-            if (pvector->bitvector[i] != INT_MIN && (vvector->bitvector[i] > ilow && vvector->bitvector[i] < ihigh)) {
-                val = INT_MAX;
-            }
-            else {
-                val = INT_MIN;
-            }
-            cat->bitvector[i] = val;
-        }
+        select_from_vectors(pvector, vvector, ilow, ihigh, NULL, cat);
         cat->in_vpool = true;
         put(variable_pool, *cat);
     }
@@ -1968,7 +2353,16 @@ MULTITHREADING THE SELECT
 
 void* threadFunction(void* arg) {
     ThreadArgs* threadArgs = (ThreadArgs*) arg;
-    if (threadArgs->is_column == true) {
+    if (threadArgs->is_column == true && threadArgs->column != NULL) {
+        // binary column: scan this thread's rows straight from the mapping
+        select_binary_range(threadArgs->column, threadArgs->ilow, threadArgs->ihigh,
+                threadArgs->bitmap + threadArgs->startLine / 64, threadArgs->startLine, threadArgs->endLine);
+        if (threadArgs->bloom != NULL) {
+            bloom_filter_bitmap(threadArgs->bloom, threadArgs->values + threadArgs->startLine,
+                    threadArgs->endLine - threadArgs->startLine, threadArgs->bitmap + threadArgs->startLine / 64);
+        }
+    }
+    else if (threadArgs->is_column == true) {
         // Check if we can index the column
         char* indexname = createIndexName(threadArgs->filepath);
         FILE* indfile = fopen(indexname, "rb");
@@ -1979,8 +2373,7 @@ void* threadFunction(void* arg) {
                     int size = index->num_items;
                     int* values = index->data;
                     int* positions = index->positions;
-                    int rangeSize = threadArgs->endLine - threadArgs->startLine;
-                    memset(threadArgs->bitvector, INT_MIN, (threadArgs->endOffset - threadArgs->startOffset) * sizeof(int));
+                    // bitvector is shared by every morsel and already filled with INT_MIN
                     // startline-1 TO endline
 
                     int pos_low = binary_search_range(values, threadArgs->startLine-1, threadArgs->endLine, threadArgs->ilow);
@@ -1999,8 +2392,7 @@ void* threadFunction(void* arg) {
                     int size = index->num_items;
                     int* values = index->data;
                     int* positions = index->positions;
-                    int rangeSize = threadArgs->endLine - threadArgs->startLine;
-                    memset(threadArgs->bitvector, INT_MIN, (threadArgs->endOffset - threadArgs->startOffset) * sizeof(int));
+                    // bitvector is shared by every morsel and already filled with INT_MIN
                     // startline-1 TO endline
 
                     int pos_low = binary_search_range(values, threadArgs->startLine-1, threadArgs->endLine, threadArgs->ilow);
@@ -2056,7 +2448,8 @@ void* threadFunction(void* arg) {
                 int lineval = atoi(line);
                 // Now 'line' contains the current line from the file without the newline character
                 int val;
-                if (lineval < threadArgs->ihigh && lineval >= threadArgs->ilow) {
+                if (lineval < threadArgs->ihigh && lineval >= threadArgs->ilow
+                        && (threadArgs->bloom == NULL || bloom_may_contain(threadArgs->bloom, lineval))) {
                     val = INT_MAX;
                 }
                 else {
@@ -2086,26 +2479,162 @@ void* threadFunction(void* arg) {
             return NULL;
         }
     } 
-    else {
+    //fprintf(stdout, "DO I FINISH ANY THREAD?\n");
+    return NULL;
+}
 
-        // assume that both vectors are the same size (one is treated as a bit vector and one as val vector)
-        for (int i=threadArgs->startLine; i<threadArgs->endLine; i++) {
-            int val;
-            if (threadArgs->pvector[i] != INT_MIN && (threadArgs->vvector[i] 
-                        >= threadArgs->ilow && threadArgs->vvector[i] < threadArgs->ihigh)) {
-                //fprintf(stdout, "%i IS between %i and %i. So line %i is a YES!\n", threadArgs->vvector[i], threadArgs->ilow, threadArgs->ihigh,i);
-                val = INT_MAX;
+/**
+ * Runs threadFunction on one morsel of rows [start, end) for the worker pool.
+ * arg is the ThreadArgs shared by the whole query. For text columns the
+ * morsel is in line numbers (line 0 is the header) and every line up to and
+ * including endOffset is read, so the morsel stops at line end - 1.
+ */
+void select_morsel(void* arg, int start, int end) {
+    ThreadArgs local = *(ThreadArgs*) arg;
+    local.startLine = start;
+    local.endLine = end;
+    if (local.lineOffsets != NULL) {
+        local.endLine = end - 1;
+        local.startOffset = local.lineOffsets[start];
+        local.endOffset = local.lineOffsets[end - 1];
+    }
+    threadFunction(&local);
+}
+
+/**
+ * True if entry only holds doubles: group averages, or group sums too large
+ * for an int. Operators reading int values cannot take it.
+ */
+static bool holds_doubles(CatalogEntry* entry, char* name) {
+    if (entry != NULL && entry->dvector != NULL) {
+        log_err("%s holds group results that are not ints\n", name);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * get() for handles whose contents are about to be read: selects, fetches
+ * and arithmetic that have only been planned are run first. Returns NULL
+ * for handles that only hold doubles.
+ */
+CatalogEntry* get_result(CatalogHashtable* variable_pool, char* name) {
+    CatalogEntry* entry = get(variable_pool, name);
+    if (materialize_result(entry) != 0 || holds_doubles(entry, name)) {
+        return NULL;
+    }
+    return entry;
+}
+
+/**
+ * get() for the value vector or plan an aggregate reads. Sets the status and
+ * returns NULL if there is none under name or it only holds doubles.
+ */
+static CatalogEntry* get_values(CatalogHashtable* variable_pool, char* name, message* send_message) {
+    CatalogEntry* entry = get(variable_pool, name);
+    if (entry == NULL) {
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+    if (holds_doubles(entry, name)) {
+        send_message->status = EXECUTION_ERROR;
+        return NULL;
+    }
+    return entry;
+}
+
+/**
+ * Runs the plans in variable_pool that read a column of table (db.tbl), for
+ * an insert that is about to move the table's rows. Returns -1 if one of
+ * them fails.
+ */
+int materialize_table_plans(CatalogHashtable* variable_pool, const char* table) {
+    int num_entries = 0;
+    int capacity = 16;
+    CatalogEntry** entries = malloc(capacity * sizeof(CatalogEntry*));
+    if (!entries) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    pthread_mutex_lock(&variable_pool->mutex);
+    for (int i = 0; i < 5003 && entries != NULL; i++) {
+        for (CatalogEntry* node = variable_pool->table[i]; node != NULL; node = node->next) {
+            if (!plan_reads_table(node->plan, table)) {
+                continue;
             }
-            else {
-                val = INT_MIN;
-                //fprintf(stdout, "%i IS NOT between %i and %i. So line %i is a NO!\n", threadArgs->vvector[i], threadArgs->ilow, threadArgs->ihigh,i);
+            if (num_entries == capacity) {
+                CatalogEntry** copy = realloc(entries, capacity * 2 * sizeof(CatalogEntry*));
+                if (!copy) {
+                    perror("Allocation failure");
+                    free(entries);
+                    entries = NULL;
+                    break;
+                }
+                entries = copy;
+                capacity *= 2;
             }
-            threadArgs->bitvector[i] = val;
+            entries[num_entries++] = node;
+        }
+    }
+    pthread_mutex_unlock(&variable_pool->mutex);
+    if (entries == NULL) {
+        return -1;
+    }
+    // entries stay in the pool until release_retired(), after this command
+    int ret = 0;
+    for (int i = 0; i < num_entries; i++) {
+        if (materialize_result(entries[i]) != 0) {
+            ret = -1;
         }
+    }
+    free(entries);
+    return ret;
+}
 
+/**
+ * Plans an aggregate over the value plan of input and runs it.
+ */
+DbOperator* plan_aggregate(CatalogEntry* input, AggregateType type, char* handle, message* send_message,
+                           CatalogHashtable* variable_pool) {
+    DbOperator* dbo = calloc(1, sizeof(DbOperator));
+    if (!dbo) {
+        perror("Memory allocation failed");
+        return NULL;
     }
-    //fprintf(stdout, "DO I FINISH ANY THREAD?\n");
-    return NULL;
+    dbo->type = AGGREGATE;
+    dbo->operator_fields.aggregate_operator.aggregate_type = type;
+    dbo->operator_fields.aggregate_operator.input = input->plan;
+    strcpy(dbo->handle, handle);
+    dbo->variable_pool = variable_pool;
+    if (execute_db_operator(dbo) != 0) {
+        send_message->status = EXECUTION_ERROR;
+        free(dbo);
+        return NULL;
+    }
+    return dbo;
+}
+
+/**
+ * Plans arithmetic over the value plans of left and right, which must be
+ * aligned. A NULL plan stands for the scalar next to it.
+ */
+DbOperator* plan_arithmetic(DbOperator* left, int left_scalar, DbOperator* right, int right_scalar,
+                            ArithmeticType type, char* handle, CatalogHashtable* variable_pool) {
+    DbOperator* dbo = calloc(1, sizeof(DbOperator));
+    if (!dbo) {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+    dbo->type = ARITHMETIC;
+    dbo->operator_fields.arithmetic_operator.arith_type = type;
+    dbo->operator_fields.arithmetic_operator.left = left;
+    dbo->operator_fields.arithmetic_operator.right = right;
+    dbo->operator_fields.arithmetic_operator.left_scalar = left_scalar;
+    dbo->operator_fields.arithmetic_operator.right_scalar = right_scalar;
+    strcpy(dbo->handle, handle);
+    dbo->variable_pool = variable_pool;
+    execute_db_operator(dbo);
+    return dbo;
 }
 
 DbOperator* parse_select_multithread(char* query_command, char* handle, message* send_message, CatalogHashtable* variable_pool) {
@@ -2116,9 +2645,8 @@ DbOperator* parse_select_multithread(char* query_command, char* handle, message*
     query_command++;
     char** command_index = &query_command;
 
-    int threadCount = 4; // Number of threads
-    pthread_t threads[threadCount];
-    ThreadArgs args[threadCount];
+    ThreadArgs args;
+    memset(&args, 0, sizeof(ThreadArgs));
     
     // parse table input
     char* arg1 = next_token(command_index, &send_message->status);
@@ -2152,46 +2680,36 @@ DbOperator* parse_select_multithread(char* query_command, char* handle, message*
             Index* index = deserializeIndex(indfile);     
             switch (index->type) {
                case BTREE_CLUSTERED: {
-                    CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+                    CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
                     if (!cat) {
                         perror("Failed to allocate memory for CatalogEntry");
                         return NULL;
                     }
 
-                    // Wait for threads and aggregate results
-                    cat->bitv_capacity = index->num_items * sizeof(int);
-                    cat->bitvector = malloc(index->num_items * sizeof(int));
+                    uint64_t* bitmap = calloc((index->num_items + 63) / 64 + 1, sizeof(uint64_t));
                     strcpy(cat->name, handle);
-
-                    cat->size = index->num_items;
                     cat->in_vpool = true;
 
                     int* base_data;
                     BPTreeNode* loaded_root = load_bptree(indfile, base_data);
                     int pos_min = find_pos(loaded_root,ilow, 1);
                     int pos_max = find_pos(loaded_root, ihigh, 0);
-                    int* retsel = malloc(sizeof(int) * index->num_items);
-                    memset(cat->bitvector, INT_MIN, (sizeof(int) * index->num_items));
-                    for (int i=pos_min; i<pos_max; i++) {
-                        cat->bitvector[i] = INT_MAX;
-                    }
+                    // clustered: the qualifying rows are one contiguous run
+                    bitmap_set_range(bitmap, pos_min, pos_max);
+                    positions_from_bitmap(cat, bitmap, index->num_items);
                     put(variable_pool, *cat);
                     return NULL;
                     break;
                 }
                 case BTREE_UNCLUSTERED: {
-                   CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+                   CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
                     if (!cat) {
                         perror("Failed to allocate memory for CatalogEntry");
                         return NULL;
                     }
 
-                    // Wait for threads and aggregate results
-                    cat->bitv_capacity = index->num_items * sizeof(int);
-                    cat->bitvector = malloc(index->num_items * sizeof(int));
+                    uint64_t* bitmap = calloc((index->num_items + 63) / 64 + 1, sizeof(uint64_t));
                     strcpy(cat->name, handle);
-
-                    cat->size = index->num_items;
                     cat->in_vpool = true;
 
                     int num_results;
@@ -2201,10 +2719,11 @@ DbOperator* parse_select_multithread(char* query_command, char* handle, message*
                     BPTreeNode* loaded_root = load_bptree(indfile, base_data);
                     // get resulting positions
                     find_pos_range(loaded_root, &num_results, &ret_indices, &ilow, &ihigh);
-                    memset(cat->bitvector, INT_MIN, (sizeof(int) * index->num_items));
+                    // leaf order is value order, the bitmap puts the rows back in row order
                     for (int i=0; i<num_results; i++) {
-                        cat->bitvector[ret_indices[i]] = INT_MAX;
+                        bitmap[ret_indices[i] / 64] |= 1ULL << (ret_indices[i] % 64);
                     }
+                    positions_from_bitmap(cat, bitmap, index->num_items);
                     put(variable_pool, *cat);
                     return NULL;
                     break;
@@ -2213,6 +2732,29 @@ DbOperator* parse_select_multithread(char* query_command, char* handle, message*
             }  
         }
 
+        // Binary column: planned like the single core select, but the scan
+        // runs on the worker pool if the whole result is needed
+        ColumnHeader header;
+        if (read_column_header(arg1, &header) == 0) {
+            DbOperator* dbo = calloc(1, sizeof(DbOperator));
+            if (!dbo) {
+                perror("Memory allocation failed");
+                return NULL;
+            }
+            dbo->type = SELECT;
+            SelectOperator* select = &dbo->operator_fields.select_operator;
+            strcpy(select->column, arg1);
+            select->low = ilow;
+            select->high = ihigh;
+            select->num_rows = header.row_count;
+            select->shifts = header.shifts;
+            select->parallel = true;
+            strcpy(dbo->handle, handle);
+            dbo->variable_pool = variable_pool;
+            execute_db_operator(dbo);
+            return dbo;
+        }
+
        // open column file
         FILE* file = fopen(fullpath, "r");
         if (!file) {
@@ -2262,166 +2804,80 @@ DbOperator* parse_select_multithread(char* query_command, char* handle, message*
         
         fclose(file);
 
-        int nums[5];
-        nums[0] = 1;
-        nums[1] = lineCount / 4;
-        nums[2] = (lineCount / 4) * 2;
-        nums[3] = (lineCount / 4) * 3;
-        nums[4] = lineCount-1;
+        CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+        if (!cat) {
+            perror("Failed to allocate memory for CatalogEntry");
+            return NULL;
+        }
 
-
-        // Split the file into portions and initialize thread arguments
-        for (int i = 0; i < threadCount; ++i) {
-            args[i].startLine = nums[i];
-            args[i].endLine = nums[i+1];
-            args[i].startOffset = lineOffsets[nums[i]]; // Calculate start line for this thread
-            args[i].endOffset = lineOffsets[nums[i+1]]; // Calculate end line for this thread
-            //fprintf(stdout, "THREAD %i is %i (offset %i) to %i (offset %i)\n", i, nums[i], lineOffsets[nums[i]], nums[i+1], lineOffsets[nums[i+1]]);
-            strcpy(args[i].filepath, fullpath);
-            args[i].is_column = true;
-            strcpy(args[i].handle, handle);
-            args[i].ihigh = ihigh;
-            args[i].ilow = ilow;
-            args[i].bitvector = malloc((lineOffsets[nums[i+1]] - lineOffsets[nums[i]]) * sizeof(int));
-            // Initialize other necessary fields
-
-            // Create the thread
-            if (pthread_create(&threads[i], NULL, threadFunction, &args[i])) {
-                perror("Failed to create thread");
-            }
-        }
-
-        CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
-        if (!cat) {
-            perror("Failed to allocate memory for CatalogEntry");
-            return NULL;
-        }
-
-        // Wait for threads and aggregate results
-        int* finalBitvector = malloc(lineCount * sizeof(int));
+        // morsels write straight into the result; rows the index branches
+        // do not mark stay INT_MIN
         cat->bitv_capacity = lineCount * sizeof(int);
         cat->bitvector = malloc(lineCount * sizeof(int));
-        int finalIndex = 0;
-        for (int i = 0; i < threadCount; ++i) {
-            pthread_join(threads[i], NULL);
-            /*
-            int segmentSize = nums[i+1] - nums[i];
-            memcpy(finalBitvector + finalIndex, args[i].bitvector, segmentSize * sizeof(int));
-            finalIndex += segmentSize;
-            */
-            for (int j=args[i].startLine-1; j<args[i].endLine; ++j) {
-                if (args[i].bitvector[j] == INT_MAX) {
-                    cat->bitvector[j] = INT_MAX;
-                }
-                else {
-                    cat->bitvector[j] = INT_MIN;
-                }
-                finalBitvector[j] = args[i].bitvector[j];
-            }
-            free(args[i].bitvector);  // Free the individual bitvector
-        }
+        for (int i = 0; i < lineCount; i++) {
+            cat->bitvector[i] = INT_MIN;
+        }
+
+        strcpy(args.filepath, fullpath);
+        args.is_column = true;
+        args.values = NULL;
+        args.column = NULL;
+        args.lineOffsets = lineOffsets;
+        strcpy(args.handle, handle);
+        args.ihigh = ihigh;
+        args.ilow = ilow;
+        args.bitvector = cat->bitvector;
+        thread_pool_run(select_morsel, &args, 1, lineCount, MORSEL_SIZE);
+        free(lineOffsets);
 
         // TODO: GET RESULTS AND JOIN THEM
 
         strcpy(cat->name, handle);
-        cat->size = lineCount;
+        // lineCount includes the header line
+        cat->size = lineCount - 1;
         cat->in_vpool = true;
+        positions_from_markers(cat);
         put(variable_pool, *cat);
-        free(finalBitvector);
 
     }
 
     else {
         // Dealing with pos vector
-        CatalogEntry* pvector = get(variable_pool, arg1);
+        CatalogEntry* pvector = get_result(variable_pool, arg1);
         char* vvector_name = next_token(command_index, &send_message->status);
-        CatalogEntry* vvector = get(variable_pool, vvector_name);
-        int size = pvector->size;
+        CatalogEntry* vvector = get_result(variable_pool, vvector_name);
 
         char* low = next_token(command_index, &send_message->status);
         char* high = next_token(command_index, &send_message->status);
         high = trim_parenthesis(high);
         int ilow;
         int ihigh;
-        if (!low) {
+        if (!low || strcmp(low, "null") == 0) {
             ilow = INT_MIN;
         } else {
             ilow = atoi(low);
         }
-        if (!high) {
+        if (!high || strcmp(high, "null") == 0) {
             ihigh = INT_MAX;
         } else {
             ihigh = atoi(high);
         }
-
-        int count = size;
-
-        int nums[5];
-        nums[0] = 0;
-        nums[1] = count / 4;
-        nums[2] = (count / 4) * 2;
-        nums[3] = (count / 4) * 3;
-        nums[4] = count;
-
-
-        // Split the file into portions and initialize thread arguments
-        for (int i = 0; i < threadCount; ++i) {
-            args[i].startLine = nums[i]; // Calculate start line for this thread
-            args[i].endLine = nums[i+1]; // Calculate end line for this thread
-            fprintf(stdout, "Thread %i is line %i to %i\n", i, nums[i], nums[i+1]);
-            args[i].is_column = false;
-            strcpy(args[i].handle, handle);
-            args[i].ihigh = ihigh;
-            args[i].ilow = ilow;
-            //args[i].pvector = pvector->bitvector;
-            memcpy(args[i].pvector, pvector->bitvector, (count * sizeof(int)));
-            //args[i].vvector = vvector->bitvector;
-            memcpy(args[i].vvector, vvector->bitvector, (count * sizeof(int)));
-            // Initialize other necessary fields
-            args[i].bitvector = malloc((count) * sizeof(int));
-            //memcpy(args[i].bitvector, vvector->bitvector, count * sizeof(int));
-
-            // Create the thread
-            if (pthread_create(&threads[i], NULL, threadFunction, &args[i])) {
-                perror("Failed to create thread");
-            }
+        if (!pvector || !vvector) {
+            log_err("Unknown select input\n");
+            send_message->status = OBJECT_NOT_FOUND;
+            return NULL;
         }
 
-        CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+        // proportional to the size of the inputs, so not worth splitting up
+        CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
         if (!cat) {
             perror("Failed to allocate memory for CatalogEntry");
             return NULL;
         }
-
-        // Wait for threads and aggregate results
-        int* finalBitvector = malloc(count * sizeof(int));
-        cat->bitv_capacity = count * sizeof(int);
-        cat->bitvector = malloc(cat->bitv_capacity);
-        int finalIndex = 0;
-        for (int i = 0; i < threadCount; ++i) {
-            pthread_join(threads[i], NULL);
-
-            for (int j=args[i].startLine; j<args[i].endLine; ++j) {
-                if (args[i].bitvector[j] == INT_MAX) {
-                    cat->bitvector[j] = INT_MAX;
-                }
-                else {
-                    cat->bitvector[j] = INT_MIN;
-                }
-                finalBitvector[j] = args[i].bitvector[j];
-            }
-            free(args[i].bitvector);  // Free the individual bitvector
-        }
-
-        // TODO: GET RESULTS AND JOIN THEM
-    
-        //fprintf(stdout, "AM I HERE ?");
         strcpy(cat->name, handle);
-        //memcpy(cat->bitvector, finalBitvector, (count * sizeof(int)));
-        cat->size = count;
+        select_from_vectors(pvector, vvector, ilow, ihigh, NULL, cat);
         cat->in_vpool = true;
         put(variable_pool, *cat);
-        free(finalBitvector);
 
     }
 
@@ -2469,14 +2925,76 @@ DbOperator* parse_fetch(char* query_command, char* handle, message* send_message
     */
     char* fullpath = catpath;
     strcat(fullpath, ".txt");
+    // retrieve bitvector
+    CatalogEntry* pvector = get(variable_pool, bitvname);
+    if (!pvector) {
+        perror("Error retrieving position vector");
+        return NULL;
+    }
+
+    // Fetching from a select that has only been planned is planned as well,
+    // so that an aggregate over it can run both a vector at a time
+    ColumnHeader header;
+    if (pvector->plan != NULL && pvector->plan->type == SELECT
+            && read_column_header(colname, &header) == 0) {
+        DbOperator* dbo = calloc(1, sizeof(DbOperator));
+        if (!dbo) {
+            perror("Memory allocation failed");
+            return NULL;
+        }
+        dbo->type = FETCH;
+        strcpy(dbo->operator_fields.fetch_operator.column, colname);
+        dbo->operator_fields.fetch_operator.positions = pvector->plan;
+        strcpy(dbo->handle, handle);
+        dbo->variable_pool = variable_pool;
+        free(catpath);
+        execute_db_operator(dbo);
+        return dbo;
+    }
+    if (materialize_result(pvector) != 0) {
+        return NULL;
+    }
+
+    // Gather straight from the binary copy of the column when there is one
+    ColumnFile* bin = open_binary_column(colname, variable_pool);
+    if (bin != NULL) {
+        CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+        if (!cat) {
+            perror("Failed to allocate memory for CatalogEntry");
+            column_file_close(bin);
+            return NULL;
+        }
+        // the result holds just the values of the qualifying rows, in row order
+        int max_count = pvector->size;
+        strcpy(cat->name, handle);
+        // remember where the values came from, so joins can use its index
+        strcpy(cat->filepath, colname);
+        cat->bitv_capacity = (max_count > 0 ? max_count : 1) * sizeof(int);
+        cat->bitvector = (int*) malloc(cat->bitv_capacity);
+        PositionCursor cursor;
+        position_cursor_init(&cursor, pvector);
+        int count = 0;
+        int pos;
+        while ((pos = position_cursor_next(&cursor)) != -1 && (size_t) pos < bin->count) {
+            cat->bitvector[count++] = bin->values[pos];
+        }
+        cat->size = count;
+        cat->in_vpool = true;
+        cat->has_value = false;
+        column_file_close(bin);
+        put(variable_pool, *cat);
+        free(cat);
+        free(catpath);
+        DbOperator* dbo = malloc(sizeof(DbOperator));
+        return dbo;
+    }
+
     // open column file
     FILE* file = fopen(fullpath, "r");
     if (!file) {
         perror("Error opening file");
         return NULL;
         }
-    // retrieve bitvector
-    CatalogEntry* pvector = get(variable_pool, bitvname);
 
  
 
@@ -2488,62 +3006,55 @@ DbOperator* parse_fetch(char* query_command, char* handle, message* send_message
         return NULL;
     }
 
-    CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+    CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
     if (!cat) {
         perror("Failed to allocate memory for CatalogEntry");
         return NULL;
     }
     strcpy(cat->name, handle);
-    cat->bitv_capacity = START_CAPACITY * sizeof(int);
+    strcpy(cat->filepath, colname);
+    int max_count = pvector->size;
+    cat->bitv_capacity = (max_count > 0 ? max_count : 1) * sizeof(int);
     cat->bitvector = (int*) malloc(cat->bitv_capacity);
 
-    int count = 0;
-    // Now loop through each subsequent line
+    // Read the column once, then gather: join results are not in row order
+    int num_lines = 0;
+    int lines_capacity = START_CAPACITY;
+    int* lines = malloc(lines_capacity * sizeof(int));
+    if (!lines) {
+        perror("Memory allocation failed");
+        fclose(file);
+        return NULL;
+    }
     while (fgets(line, sizeof(line), file)) {
-        //fprintf(stdout, "LINE IS: %s\n", line);
-        //fprintf(stdout, "PVECTOR NAME IS: %s\n", pvector->name);
         if (strncmp(line, "\0", 1) == 0) {
             break;
         }
-        // Remove the newline character, if present
-        size_t len = strlen(line);
-        if (len > 0 && line[len - 1] == '\n') {
-            line[len - 1] = '\0';
-        }
-        int lineval = atoi(line);
-
-        if (count * sizeof(int) < cat->bitv_capacity) {
-            // Now 'line' contains the current line from the file without the newline character
-            if (pvector->bitvector[count] != INT_MIN) {
-                //fprintf(stdout, "THIS IS!!! IN THE SET\n");
-                cat->bitvector[count] = lineval;
-            }
-            else {
-                cat->bitvector[count] = INT_MIN;
-                //fprintf(stdout, "THIS IS NOT! IN THE SET\n");
-            }
-        }
-        else {
-            int* bitvcopy = (int*) realloc(cat->bitvector, cat->bitv_capacity *2);
-            cat->bitv_capacity*=2;
-            if (bitvcopy == NULL) {
+        if (num_lines == lines_capacity) {
+            int* linescopy = (int*) realloc(lines, lines_capacity * 2 * sizeof(int));
+            if (linescopy == NULL) {
                 perror("Allocation failure");
+                free(lines);
+                fclose(file);
                 return NULL;
-            } else {
-                cat->bitvector = bitvcopy;
-                // Now 'line' contains the current line from the file without the newline character
-                if (pvector->bitvector[count] != INT_MIN) {
-                    //fprintf(stdout, "THIS IS!!! IN THE SET\n");
-                    cat->bitvector[count] = lineval;
-                }
-                else {
-                    cat->bitvector[count] = INT_MIN;
-                    //fprintf(stdout, "THIS IS NOT! IN THE SET\n");
-                }
             }
+            lines = linescopy;
+            lines_capacity *= 2;
+        }
+        lines[num_lines++] = atoi(line);
+    }
+    fclose(file);
+
+    PositionCursor cursor;
+    position_cursor_init(&cursor, pvector);
+    int count = 0;
+    int pos;
+    while ((pos = position_cursor_next(&cursor)) != -1) {
+        if (pos < num_lines) {
+            cat->bitvector[count++] = lines[pos];
         }
-        count++;
     }
+    free(lines);
     cat->size = count;
     cat->in_vpool = true;
     cat->has_value = false;
@@ -2554,7 +3065,23 @@ DbOperator* parse_fetch(char* query_command, char* handle, message* send_message
     return dbo;
 }
 
-int print_column(char* token) {
+int print_column(char* token, CatalogHashtable* variable_pool) {
+    ColumnFile* bin = open_binary_column(token, variable_pool);
+    if (bin != NULL) {
+        FILE *combinedFile = fopen("combined_data.txt", "a");
+        if (!combinedFile) {
+            perror("Error opening combined file");
+            column_file_close(bin);
+            return 0;
+        }
+        for (size_t i = 0; i < bin->count; i++) {
+            fprintf(combinedFile, "%d\n,", bin->values[i]);
+        }
+        fclose(combinedFile);
+        column_file_close(bin);
+        return 1;
+    }
+
     char* name = getName(token);
     // retrieve filename from catalog
     FILE* file1 = fopen("catalogue.txt", "r");
@@ -2595,8 +3122,23 @@ int print_column(char* token) {
     return 1;
 }   
 
+// Prints whole numbers without decimals. The range check comes first so
+// that NaN and out of range values are never cast.
+static void print_double(FILE* file, double value) {
+    if (value >= LLONG_MIN && value < LLONG_MAX && value == (long long) value) {
+        fprintf(file, "%lld", (long long) value);
+    } else {
+        fprintf(file, "%.2f", value);
+    }
+}
+
 int print_vector(char* token, CatalogHashtable* variable_pool) {
+    // group results that are doubles print as they are
     CatalogEntry* vvector = get(variable_pool, token);
+    if (vvector == NULL || materialize_result(vvector) != 0) {
+        log_err("No result under %s\n", token);
+        return 0;
+    }
     FILE *combinedFile = fopen("combined_data.txt", "a");
     if (!combinedFile) {
         perror("Error opening combined file");
@@ -2605,27 +3147,44 @@ int print_vector(char* token, CatalogHashtable* variable_pool) {
     // check if it simply a return value and not a full vector
     if (vvector->has_value == true) {
         fprintf(stdout, "THIS HAS A VALUE UH OH!!!");
-        char buffer[12];
-        if (vvector->value == (int) vvector->value) {
-            snprintf(buffer, sizeof(buffer), "%d", (int)vvector->value);
+        if (vvector->is_int) {
+            fprintf(combinedFile, "%lld", vvector->int_value);
         }
         else {
-            snprintf(buffer, sizeof(buffer), "%.2f", vvector->value);
+            print_double(combinedFile, vvector->value);
         }
-        fputs(buffer, combinedFile);
         //fputc(',', combinedFile);
     }
+    else if (vvector->dvector != NULL) {
+        // group sums and averages print like single values
+        for (int i = 0; i < vvector->size; i++) {
+            print_double(combinedFile, vvector->dvector[i]);
+            fputc('\n', combinedFile);
+        }
+    }
+    else if (is_position_result(vvector)) {
+        // select results print the qualifying rows
+        PositionCursor cursor;
+        position_cursor_init(&cursor, vvector);
+        int pos;
+        while ((pos = position_cursor_next(&cursor)) != -1) {
+            fprintf(combinedFile, "%d\n", pos);
+        }
+    }
     else {
         int size = vvector->size;
         fprintf(stdout, "SIZE IS: %i", size);
         for (int i=0; i<size; i++) {
-            if (vvector->bitvector[i] != INT_MIN && vvector->bitvector[i] != INT_MAX) {
-                char buffer[12];
+            char buffer[12];
+            if (arith_is_null(vvector->valid, i)) {
+                // rows divided by zero
+                strcpy(buffer, "null");
+            } else {
                 snprintf(buffer, sizeof(buffer), "%d", vvector->bitvector[i]);
-                /*log_err(buffer);*/
-                fputs(buffer, combinedFile);
-                fputs("\n", combinedFile);
             }
+            /*log_err(buffer);*/
+            fputs(buffer, combinedFile);
+            fputs("\n", combinedFile);
         }
     }
     //fputc('\n', combinedFile);
@@ -2664,7 +3223,7 @@ char* parse_print(char* query_command, message* send_message, CatalogHashtable*
     while (last_char < 0 || token[last_char] != ')') {
         if (contains_dot(token)) {
             fprintf(stdout, "PRINTING A COLUMN!!!");
-            print_column(token);
+            print_column(token, variable_pool);
         }
         else {
             fprintf(stdout, "PRINTING A VECTOR!!!");
@@ -2684,7 +3243,7 @@ char* parse_print(char* query_command, message* send_message, CatalogHashtable*
     token = trim_parenthesis(token);
     if (contains_dot(token)) {
         fprintf(stdout, "PRINTING A COLUMN!!!");
-        print_column(token);
+        print_column(token, variable_pool);
     }
     else {
         fprintf(stdout, "PRINTING A VECTOR!!!");
@@ -2749,12 +3308,22 @@ DbOperator* parse_avg(char* query_command, char* handle, message* send_message,
     CatalogEntry* pvector;
 
     //TODO: IN THE CASE THAT WE WANT AVERAGE OF A COLUMN - SO LOOK FOR IT IN CATALOG THEN DO SAME THING
-    float ret;
-    int sum = 0;
-    int div = 0;
-    int count;
+    double ret;
+    long long sum = 0;
+    long long div = 0;
+    AggregatePartial total;
     // If column
-    if (contains_dot(arg1)) {
+    ColumnFile* bin = NULL;
+    if (contains_dot(arg1) && (bin = open_binary_column(arg1, variable_pool)) != NULL) {
+        int failed = aggregate_values(bin->values, NULL, bin->count, &total);
+        column_file_close(bin);
+        if (failed < 0) {
+            return NULL;
+        }
+        sum = total.sum;
+        div = total.count;
+    }
+    else if (contains_dot(arg1)) {
         char* name = getName(arg1);
         
         // retrieve filename from catalog
@@ -2801,21 +3370,26 @@ DbOperator* parse_avg(char* query_command, char* handle, message* send_message,
     // If value vector
     else {
         // get value vector
-        pvector = get(variable_pool, arg1);
-        int count = pvector->size;
-        for (int i=0; i< count; i++) {
-            if (pvector->bitvector[i] < INT_MAX && pvector->bitvector[i] > INT_MIN) {
-                sum += pvector->bitvector[i];
-                div += 1;
-            }
+        pvector = get_values(variable_pool, arg1, send_message);
+        if (pvector == NULL) {
+            return NULL;
+        }
+        if (plan_has_values(pvector->plan)) {
+            return plan_aggregate(pvector, AGG_AVG, handle, send_message, variable_pool);
         }
+        materialize_result(pvector);
+        // fetched vectors only hold the qualifying values
+        if (aggregate_values(pvector->bitvector, pvector->valid, pvector->size, &total) < 0) {
+            return NULL;
+        }
+        sum = total.sum;
+        div = total.count;
     }
     
-
+    ret = (double) sum / div;
     // ret now has average
-    ret = (float) sum / div;
 
-    CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+    CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
 
     if (!cat) {
         perror("Failed to allocate memory for CatalogEntry");
@@ -2845,9 +3419,19 @@ DbOperator* parse_sum(char* query_command, char* handle, message* send_message,
     arg1 = trim_parenthesis(arg1);
     CatalogEntry* pvector;
 
-    int ret = 0;
+    long long ret = 0;
+    AggregatePartial total;
     // if column
-    if (contains_dot(arg1)) {
+    ColumnFile* bin = NULL;
+    if (contains_dot(arg1) && (bin = open_binary_column(arg1, variable_pool)) != NULL) {
+        int failed = aggregate_values(bin->values, NULL, bin->count, &total);
+        column_file_close(bin);
+        if (failed < 0) {
+            return NULL;
+        }
+        ret = total.sum;
+    }
+    else if (contains_dot(arg1)) {
         char* name = getName(arg1);
         
         // retrieve filename from catalog
@@ -2871,6 +3455,7 @@ DbOperator* parse_sum(char* query_command, char* handle, message* send_message,
             return NULL;
             }
         char line[1024];
+        long long sum = 0;
         //skip first line
         if (!fgets(line, sizeof(line), file)) {
             perror("Error reading file");
@@ -2885,26 +3470,33 @@ DbOperator* parse_sum(char* query_command, char* handle, message* send_message,
             }
             int lineval = atoi(line);
             if (lineval > INT_MIN && lineval < INT_MAX) {
-                ret += lineval;
+                sum += lineval;
             }
         }
+        ret = sum;
         // close column file
         fclose(file1);
     }
     // if vector
     else {
-        pvector = get(variable_pool, arg1);
-        int count = pvector->size;
+        pvector = get_values(variable_pool, arg1, send_message);
+        if (pvector == NULL) {
+            return NULL;
+        }
+        if (plan_has_values(pvector->plan)) {
+            return plan_aggregate(pvector, AGG_SUM, handle, send_message, variable_pool);
+        }
+        materialize_result(pvector);
 
-        for (int i=0; i< count; i++) {
-            if (pvector->bitvector[i] < INT_MAX && pvector->bitvector[i] > INT_MIN) {
-                ret += pvector->bitvector[i];
-            }
+        // fetched vectors only hold the qualifying values
+        if (aggregate_values(pvector->bitvector, pvector->valid, pvector->size, &total) < 0) {
+            return NULL;
         }
+        ret = total.sum;
     }
 
     // ret now has sum
-    CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+    CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
     if (!cat) {
         perror("Failed to allocate memory for CatalogEntry");
         return NULL;
@@ -2912,9 +3504,86 @@ DbOperator* parse_sum(char* query_command, char* handle, message* send_message,
 
     strcpy(cat->name, handle);
     cat->has_value = true;
-    cat->value = ret;
+    cat->is_int = true;
+    cat->int_value = ret;
+    cat->in_vpool = true;
+    put(variable_pool, *cat);
+
+    DbOperator* dbo = malloc(sizeof(DbOperator));
+    return dbo;
+}
+
+/**
+ * c=count(x) counts the values of the column or value vector x, or the
+ * qualifying rows of the select result x.
+ */
+DbOperator* parse_count(char* query_command, char* handle, message* send_message, CatalogHashtable* variable_pool) {
+    if (strncmp(query_command, "(", 1) != 0) {
+        send_message->status = UNKNOWN_COMMAND;
+        return NULL;
+    }
+    query_command++;
+    char** command_index = &query_command;
+    char* arg1 = next_token(command_index, &send_message->status);
+    arg1 = trim_parenthesis(arg1);
+
+    long long ret = 0;
+    ColumnHeader header;
+    if (contains_dot(arg1) && read_column_header(arg1, &header) == 0) {
+        ret = header.row_count;
+    }
+    else if (contains_dot(arg1)) {
+        // columns without a binary file: one value per line after the title
+        char* fullpath = makePath(arg1, _COLUMN);
+        FILE* file = NULL;
+        if (fullpath) {
+            strcat(fullpath, ".txt");
+            file = fopen(fullpath, "r");
+            free(fullpath);
+        }
+        if (!file) {
+            send_message->status = OBJECT_NOT_FOUND;
+            return NULL;
+        }
+        char line[1024];
+        if (fgets(line, sizeof(line), file)) {
+            while (fgets(line, sizeof(line), file)) {
+                if (line[0] != '\n' && line[0] != '\0') {
+                    ret++;
+                }
+            }
+        }
+        fclose(file);
+    }
+    else {
+        CatalogEntry* vvector = get(variable_pool, arg1);
+        if (vvector == NULL) {
+            send_message->status = OBJECT_NOT_FOUND;
+            return NULL;
+        }
+        if (plan_has_values(vvector->plan)) {
+            return plan_aggregate(vvector, AGG_COUNT, handle, send_message, variable_pool);
+        }
+        if (materialize_result(vvector) != 0) {
+            return NULL;
+        }
+        // select results hold their number of qualifying rows in size too,
+        // null values are not counted
+        ret = vvector->size - arith_count_nulls(vvector->valid, vvector->size);
+    }
+
+    CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+    if (!cat) {
+        perror("Failed to allocate memory for CatalogEntry");
+        return NULL;
+    }
+    strcpy(cat->name, handle);
+    cat->has_value = true;
+    cat->is_int = true;
+    cat->int_value = ret;
     cat->in_vpool = true;
     put(variable_pool, *cat);
+    free(cat);
 
     DbOperator* dbo = malloc(sizeof(DbOperator));
     return dbo;
@@ -2936,22 +3605,28 @@ DbOperator* parse_max(char* query_command, char* handle, message* send_message,
     // only one parameter
     if (arg1[length-1] == ')') {
         int ret = INT_MIN;
+        ColumnHeader header;
 
         arg1 = trim_parenthesis(arg1);
         if (!contains_dot(arg1)) {
             // get value vector
-            CatalogEntry* vvector = get(variable_pool, arg1);
-
-            int count = vvector->size;
-
-            for (int i=0; i < count; i++) {
-                if (vvector->bitvector[i] < INT_MAX && vvector->bitvector[i] > INT_MIN) {
-                    int temp = vvector->bitvector[i];
-                    if (temp >= ret) {
-                        ret = temp;          
-                    }
-                }
+            CatalogEntry* vvector = get_values(variable_pool, arg1, send_message);
+            if (vvector == NULL) {
+                return NULL;
+            }
+            if (plan_has_values(vvector->plan)) {
+                return plan_aggregate(vvector, AGG_MAX, handle, send_message, variable_pool);
+            }
+            materialize_result(vvector);
+            AggregatePartial total;
+            if (aggregate_values(vvector->bitvector, vvector->valid, vvector->size, &total) < 0) {
+                return NULL;
             }
+            ret = total.max;
+        }
+        else if (read_column_header(arg1, &header) == 0) {
+            // the column header already tracks the max
+            ret = header.max;
         }
         else {
             char* name = getName(arg1);
@@ -3002,14 +3677,15 @@ DbOperator* parse_max(char* query_command, char* handle, message* send_message,
 
 
         // Object for first return val
-        CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+        CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
         if (!cat) {
             perror("Failed to allocate memory for CatalogEntry");
             return NULL;
         }
 
         strcpy(cat->name, handle);
-        cat->value = ret;
+        cat->int_value = ret;
+        cat->is_int = true;
         cat->has_value = true;
         cat->in_vpool = true;
         put(variable_pool, *cat);
@@ -3023,62 +3699,66 @@ DbOperator* parse_max(char* query_command, char* handle, message* send_message,
         char* arg2 = next_token(command_index, &send_message->status);
         arg2 = trim_parenthesis(arg2);
 
-        CatalogEntry* vvector = get(variable_pool, arg2);
+        CatalogEntry* vvector = get_result(variable_pool, arg2);
+        if (vvector == NULL) {
+            send_message->status = OBJECT_NOT_FOUND;
+            return NULL;
+        }
 
         int ret = INT_MIN;
         int count = vvector->size;
-        
-        // If we are search through all of the vvector
-        if (strncmp(arg1, "null", 4) == 0) {
-            for (int i=0; i < count; i++) {
-                int temp = vvector->bitvector[i];
-                if (temp >= ret && temp < INT_MAX) {
-                    ret = temp;          
-                }
+        for (int i=0; i < count; i++) {
+            int temp = vvector->bitvector[i];
+            if (temp >= ret && !arith_is_null(vvector->valid, i)) {
+                ret = temp;          
             }
         }
-        else {
-            CatalogEntry* pvector = get(variable_pool, arg1);
-            for (int i=0; i < count; i++) {
-                int temp = vvector->bitvector[i];
-                if (temp >= ret && temp < INT_MAX && pvector->bitvector[i] == INT_MAX) {
-                    ret = temp;          
-                }
-            }
+
+        // The i-th value belongs to the i-th row of the position vector, or
+        // to row i when the max is over the whole value vector
+        CatalogEntry* pvector = (strncmp(arg1, "null", 4) == 0) ? NULL : get_result(variable_pool, arg1);
+        PositionCursor cursor;
+        if (pvector) {
+            position_cursor_init(&cursor, pvector);
         }
 
         // Object for first return val
-        CatalogEntry* positionlist = (CatalogEntry *) malloc(sizeof(CatalogEntry));
-        if (!positionlist) {
+        CatalogEntry* positionlist = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+        int* list = (int*) malloc((count > 0 ? count : 1) * sizeof(int));
+        if (!positionlist || !list) {
             perror("Failed to allocate memory for CatalogEntry");
             return NULL;
         }
-        positionlist->bitv_capacity = sizeof(int) * count;
-        positionlist->bitvector = (int*) malloc(positionlist->bitv_capacity);
 
-        // Find pos of all max values -> TODO: Technically this is searching through too many values in the second case
+        // Find pos of all max values
+        int num_found = 0;
         for (int i=0; i < count; i++) {
-            int temp = vvector->bitvector[i];
-            if (temp == ret) {
-                positionlist->bitvector[i] = INT_MAX;          
+            int pos = pvector ? position_cursor_next(&cursor) : i;
+            if (pos == -1) {
+                break;
             }
-            else {
-                positionlist->bitvector[i] = INT_MIN;
+            if (vvector->bitvector[i] == ret && !arith_is_null(vvector->valid, i)) {
+                list[num_found++] = pos;
             }
         }
+        int num_rows = count;
+        if (pvector) {
+            num_rows = is_position_result(pvector) ? pvector->num_rows : pvector->size;
+        }
+        positions_from_list(positionlist, list, num_found, num_rows);
 
         // Object for second return val
-        CatalogEntry* maxvalues = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+        CatalogEntry* maxvalues = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
         if (!maxvalues) {
             perror("Failed to allocate memory for CatalogEntry");
             return NULL;
         }
 
         strcpy(positionlist->name, handle_first);
-        positionlist->size = count;
 
         strcpy(maxvalues->name, handle_second);
-        maxvalues->value = ret;
+        maxvalues->int_value = ret;
+        maxvalues->is_int = true;
         maxvalues->has_value = true;
 
         positionlist->in_vpool = true;
@@ -3110,20 +3790,28 @@ DbOperator* parse_min(char* query_command, char* handle, message* send_message,
     if (arg1[length-1] == ')') {
 
         int ret = INT_MAX;
+        ColumnHeader header;
 
         arg1 = trim_parenthesis(arg1);
         if (!contains_dot(arg1)) {
             // get value vector
-            CatalogEntry* vvector = get(variable_pool, arg1);
-            
-            int count = vvector->size;
-
-            for (int i=0; i < count; i++) {
-                int temp = vvector->bitvector[i];
-                if (temp <= ret && temp > INT_MIN) {
-                    ret = temp;          
-                }
+            CatalogEntry* vvector = get_values(variable_pool, arg1, send_message);
+            if (vvector == NULL) {
+                return NULL;
+            }
+            if (plan_has_values(vvector->plan)) {
+                return plan_aggregate(vvector, AGG_MIN, handle, send_message, variable_pool);
             }
+            materialize_result(vvector);
+            AggregatePartial total;
+            if (aggregate_values(vvector->bitvector, vvector->valid, vvector->size, &total) < 0) {
+                return NULL;
+            }
+            ret = total.min;
+        }
+        else if (read_column_header(arg1, &header) == 0) {
+            // the column header already tracks the min
+            ret = header.min;
         }
         else {
             char* name = getName(arg1);
@@ -3174,14 +3862,15 @@ DbOperator* parse_min(char* query_command, char* handle, message* send_message,
 
 
         // Object for first return val
-        CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+        CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
         if (!cat) {
             perror("Failed to allocate memory for CatalogEntry");
             return NULL;
         }
 
         strcpy(cat->name, handle);
-        cat->value = ret;
+        cat->int_value = ret;
+        cat->is_int = true;
         cat->has_value = true;
         cat->in_vpool = true;
 
@@ -3196,62 +3885,66 @@ DbOperator* parse_min(char* query_command, char* handle, message* send_message,
         char* arg2 = next_token(command_index, &send_message->status);
         arg2 = trim_parenthesis(arg2);
 
-        CatalogEntry* vvector = get(variable_pool, arg2);
+        CatalogEntry* vvector = get_result(variable_pool, arg2);
+        if (vvector == NULL) {
+            send_message->status = OBJECT_NOT_FOUND;
+            return NULL;
+        }
 
         int ret = INT_MAX;
         int count = vvector->size;
-        
-        // If we are search through all of the vvector
-        if (strcmp(arg1, "null") == 0) {
-            for (int i=0; i < count; i++) {
-                int temp = vvector->bitvector[i];
-                if (temp <= ret && temp > INT_MIN) {
-                    ret = temp;          
-                }
+        for (int i=0; i < count; i++) {
+            int temp = vvector->bitvector[i];
+            if (temp <= ret && !arith_is_null(vvector->valid, i)) {
+                ret = temp;          
             }
         }
-        else {
-            CatalogEntry* pvector = get(variable_pool, arg1);
-            for (int i=0; i < count; i++) {
-                int temp = vvector->bitvector[i];
-                if (temp <= ret && temp > INT_MIN && pvector->bitvector[i] == INT_MAX) {
-                    ret = temp;          
-                }
-            }
+
+        // The i-th value belongs to the i-th row of the position vector, or
+        // to row i when the min is over the whole value vector
+        CatalogEntry* pvector = (strcmp(arg1, "null") == 0) ? NULL : get_result(variable_pool, arg1);
+        PositionCursor cursor;
+        if (pvector) {
+            position_cursor_init(&cursor, pvector);
         }
 
         // Object for first return val
-        CatalogEntry* positionlist = (CatalogEntry *) malloc(sizeof(CatalogEntry));
-        if (!positionlist) {
+        CatalogEntry* positionlist = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+        int* list = (int*) malloc((count > 0 ? count : 1) * sizeof(int));
+        if (!positionlist || !list) {
             perror("Failed to allocate memory for CatalogEntry");
             return NULL;
         }
-        positionlist->bitv_capacity = sizeof(int) * count;
-        positionlist->bitvector = (int*) malloc(positionlist->bitv_capacity);
 
-        // Find pos of all min values -> TODO: Technically this is searching through too many values in the second case
+        // Find pos of all min values
+        int num_found = 0;
         for (int i=0; i < count; i++) {
-            int temp = vvector->bitvector[i];
-            if (temp == ret) {
-                positionlist->bitvector[i] = INT_MAX;          
+            int pos = pvector ? position_cursor_next(&cursor) : i;
+            if (pos == -1) {
+                break;
             }
-            else {
-                positionlist->bitvector[i] = INT_MIN;
+            if (vvector->bitvector[i] == ret && !arith_is_null(vvector->valid, i)) {
+                list[num_found++] = pos;
             }
         }
+        int num_rows = count;
+        if (pvector) {
+            num_rows = is_position_result(pvector) ? pvector->num_rows : pvector->size;
+        }
+        positions_from_list(positionlist, list, num_found, num_rows);
 
         // Object for second return val
-        CatalogEntry* maxvalues = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+        CatalogEntry* maxvalues = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
         if (!maxvalues) {
             perror("Failed to allocate memory for CatalogEntry");
             return NULL;
         }
 
         strcpy(positionlist->name, handle_first);
-        positionlist->size = count;
 
         strcpy(maxvalues->name, handle_second);
-        maxvalues->value = ret;
+        maxvalues->int_value = ret;
+        maxvalues->is_int = true;
         maxvalues->has_value = true;
 
         positionlist->in_vpool = true;
@@ -3266,109 +3959,827 @@ DbOperator* parse_min(char* query_command, char* handle, message* send_message,
     return dbo;
 }
 
-DbOperator* parse_add(char* query_command, char* handle, message* send_message, CatalogHashtable* variable_pool) {
+/**
+ * ArithOperand
+ * One side of an arithmetic: a value plan, a materialized value vector, or
+ * a scalar (an integer literal or a handle holding a single value).
+ */
+typedef struct ArithOperand {
+    CatalogEntry* entry;
+    DbOperator* plan;
+    int scalar;
+} ArithOperand;
+
+static int parse_arith_operand(char* token, CatalogHashtable* variable_pool, ArithOperand* operand) {
+    operand->entry = NULL;
+    operand->plan = NULL;
+    operand->scalar = 0;
+    char* end;
+    long literal = strtol(token, &end, 10);
+    if (end != token && *end == '\0') {
+        operand->scalar = (int) literal;
+        return 0;
+    }
+    CatalogEntry* entry = get(variable_pool, token);
+    if (entry == NULL) {
+        return -1;
+    }
+    if (entry->has_value && entry->is_int) {
+        operand->scalar = (int) entry->int_value;
+    } else if (entry->has_value) {
+        // averages take part with their integer part
+        if (!(entry->value >= INT_MIN && entry->value <= INT_MAX)) {
+            log_err("%s is not a number\n", token);
+            return -1;
+        }
+        operand->scalar = (int) entry->value;
+    } else if (plan_has_values(entry->plan)) {
+        operand->plan = entry->plan;
+    } else if (holds_doubles(entry, token)) {
+        return -1;
+    } else {
+        operand->entry = entry;
+    }
+    return 0;
+}
+
+/**
+ * x=add(a,b), sub, mul and div combine two value vectors fetched with the
+ * same positions row by row, or a value vector and a scalar, which is used
+ * for every row. Operands that are still plans stay plans, so a chain such
+ * as mul(add(a,b),c) runs a vector at a time without building the sum.
+ * Rows divided by zero are null: they keep their place in the result, so
+ * it still lines up with the positions, and aggregates and prints skip them.
+ */
+DbOperator* parse_arithmetic(char* query_command, char* handle, message* send_message,
+                             CatalogHashtable* variable_pool, ArithmeticType type) {
     if (strncmp(query_command, "(", 1) != 0) {
         send_message->status = UNKNOWN_COMMAND;
         return NULL;
     }
     query_command++;
     char** command_index = &query_command;
-    
-    
+
     // parse parameters
     char* arg1 = next_token(command_index, &send_message->status);
     char* arg2 = next_token(command_index, &send_message->status);
+    if (!arg1 || !arg2) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
     arg1 = trim_parenthesis(arg1);
     arg2 = trim_parenthesis(arg2);
 
-    CatalogEntry* vvector1 = get(variable_pool, arg1);
-    CatalogEntry* vvector2 = get(variable_pool, arg2);
+    ArithOperand left;
+    ArithOperand right;
+    if (parse_arith_operand(arg1, variable_pool, &left) < 0
+            || parse_arith_operand(arg2, variable_pool, &right) < 0) {
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+
+    // plans of the same select, and scalars, are combined a vector at a time
+    bool left_plannable = left.entry == NULL;
+    bool right_plannable = right.entry == NULL;
+    bool aligned = left.plan == NULL || right.plan == NULL || plans_aligned(left.plan, right.plan);
+    if (left_plannable && right_plannable && (left.plan || right.plan) && aligned) {
+        return plan_arithmetic(left.plan, left.scalar, right.plan, right.scalar, type, handle, variable_pool);
+    }
 
-    CatalogEntry* retvector = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+    CatalogEntry* retvector = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
     if (!retvector) {
         perror("Failed to allocate memory for CatalogEntry");
         return NULL;
     }
+    strcpy(retvector->name, handle);
+    retvector->in_vpool = true;
 
-    int count = vvector1->size;
-    retvector->bitv_capacity = sizeof(int) * count;
-    retvector->bitvector = (int*) malloc(retvector->bitv_capacity);
-
-    for (int i=0; i<count; i++) {
-        if ((vvector1->bitvector[i]) != INT_MIN && (vvector2->bitvector[i]) != INT_MIN 
-        && (vvector1->bitvector[i]) != INT_MAX && (vvector2->bitvector[i]) != INT_MAX) {
-            retvector->bitvector[i] = (vvector1->bitvector[i]) + (vvector2->bitvector[i]);
-        }
-        else {
-            retvector->bitvector[i] = INT_MIN;
+    const int* lvalues = NULL;
+    const int* rvalues = NULL;
+    const uint64_t* lvalid = NULL;
+    const uint64_t* rvalid = NULL;
+    int count = -1;
+    if (left.plan || left.entry) {
+        CatalogEntry* vvector = left.entry ? left.entry : get_result(variable_pool, arg1);
+        if (vvector == NULL) {
+            free(retvector);
+            return NULL;
+        }
+        lvalues = vvector->bitvector;
+        lvalid = vvector->valid;
+        count = vvector->size;
+    }
+    if (right.plan || right.entry) {
+        CatalogEntry* vvector = right.entry ? right.entry : get_result(variable_pool, arg2);
+        if (vvector == NULL) {
+            free(retvector);
+            return NULL;
+        }
+        rvalues = vvector->bitvector;
+        rvalid = vvector->valid;
+        // both inputs were fetched with the same positions, so they line up
+        count = count < 0 || vvector->size < count ? vvector->size : count;
+    }
+
+    if (count < 0) {
+        // two scalars make a single value
+        int value;
+        uint64_t valid = 1;
+        arith_apply(type, NULL, left.scalar, NULL, right.scalar, 1, &value, &valid);
+        retvector->has_value = true;
+        retvector->is_int = valid != 0;
+        retvector->int_value = value;
+        retvector->value = NAN;
+    } else {
+        retvector->bitv_capacity = sizeof(int) * (count > 0 ? count : 1);
+        retvector->bitvector = (int*) malloc(retvector->bitv_capacity);
+        uint64_t* valid = malloc(((count + 63) / 64 + 1) * sizeof(uint64_t));
+        if (!retvector->bitvector || !valid) {
+            perror("Memory allocation failed");
+            free(retvector->bitvector);
+            free(valid);
+            free(retvector);
+            return NULL;
+        }
+        memset(valid, 0, ((count + 63) / 64 + 1) * sizeof(uint64_t));
+        bitmap_set_range(valid, 0, count);
+        // a row that is null in an operand is null in the result
+        for (int w = 0; w < (count + 63) / 64; w++) {
+            valid[w] &= (lvalid ? lvalid[w] : ~0ULL) & (rvalid ? rvalid[w] : ~0ULL);
+        }
+        arith_apply(type, lvalues, left.scalar, rvalues, right.scalar, count, retvector->bitvector, valid);
+        // null rows stay in place, so the result still lines up with the
+        // positions its operands were fetched with
+        retvector->size = count;
+        retvector->has_value = false;
+        if (arith_count_nulls(valid, count) > 0) {
+            retvector->valid = valid;
+        } else {
+            free(valid);
         }
     }
-
-    strcpy(retvector->name, handle);
-    retvector->size = count;
-    retvector->in_vpool = true;
-    retvector->has_value = false;
 
     put(variable_pool, *retvector);
+    free(retvector);
 
     DbOperator* dbo = malloc(sizeof(DbOperator));
     return dbo;
 }
 
-DbOperator* parse_sub(char* query_command, char* handle, message* send_message, CatalogHashtable* variable_pool) {
+// TODO: MILESTONE 2 BATCHING QUERIES!!!
+
+
+// Helper functions for batch processing
+
+/**
+ * Pairs the i-th value of vvector with the i-th row of pvector, the way
+ * fetch produced them. input->positions is allocated here, input->values
+ * points into vvector, or if vvector holds nulls (which join nothing) is a
+ * copy without them that the caller frees as well.
+ */
+int join_input(CatalogEntry* vvector, CatalogEntry* pvector, JoinInput* input) {
+    int count = vvector->size < pvector->size ? vvector->size : pvector->size;
+    input->values = vvector->valid == NULL ? vvector->bitvector
+        : malloc((count > 0 ? count : 1) * sizeof(int));
+    input->positions = malloc((count > 0 ? count : 1) * sizeof(int));
+    if (!input->values || !input->positions) {
+        perror("Memory allocation failed");
+        if (vvector->valid != NULL) {
+            free(input->values);
+        }
+        free(input->positions);
+        return -1;
+    }
+    PositionCursor cursor;
+    position_cursor_init(&cursor, pvector);
+    int n = 0;
+    int pos;
+    for (int i = 0; i < count && (pos = position_cursor_next(&cursor)) != -1; i++) {
+        if (vvector->valid == NULL) {
+            input->positions[n++] = pos;
+        } else if (!arith_is_null(vvector->valid, i)) {
+            input->values[n] = vvector->bitvector[i];
+            input->positions[n++] = pos;
+        }
+    }
+    input->count = n;
+    return 0;
+}
+
+/**
+ * IndexOrder
+ * The rows of a column in value order, as read from its index file. Loaded
+ * once and shared by the batches and joins that walk the index until the
+ * file is rewritten. The cache keeps the INDEX_ORDER_CACHE_SIZE most
+ * recently used ones, most recent first.
+ **/
+typedef struct IndexOrder {
+    char path[MAX_SIZE_NAME]; // the index file
+    off_t file_size;
+    struct timespec mtime;
+    int* values;
+    int* positions;
+    int count;
+    int refs; // users, plus one while it is in the cache
+    struct IndexOrder* next;
+} IndexOrder;
+
+static IndexOrder* index_orders = NULL;
+static pthread_mutex_t index_orders_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Rows of a column in value order, straight from its sorted or B+tree index
+ * file indexname, as parallel arrays the caller frees. Returns 1 if the
+ * index does not cover every row of header (it is only written on sync).
+ */
+static int load_index_order(const char* indexname, const ColumnHeader* header, int** values, int** positions, int* count) {
+    FILE* indfile = fopen(indexname, "rb");
+    if (indfile == NULL) {
+        return 1;
+    }
+
+    // sorted indexes are serialized Index objects, which start with their
+    // own path; anything else in ./ind is a dumped B+tree
+    Index prefix;
+    bool is_sorted = fread(prefix.filepath, sizeof(prefix.filepath), 1, indfile) == 1
+        && fread(&prefix.type, sizeof(prefix.type), 1, indfile) == 1
+        && fread(&prefix.num_items, sizeof(prefix.num_items), 1, indfile) == 1
+        && strncmp(prefix.filepath, indexname, sizeof(prefix.filepath)) == 0
+        && (prefix.type == SORTED_CLUSTERED || prefix.type == SORTED_UNCLUSTERED);
+    rewind(indfile);
+    if (is_sorted) {
+        if (prefix.num_items != header->row_count) {
+            fclose(indfile);
+            return 1;
+        }
+        Index* index = deserializeIndex(indfile);
+        if (index == NULL) {
+            return -1;
+        }
+        *values = index->data;
+        *positions = index->positions;
+        *count = index->num_items;
+        free(index);
+        return 0;
+    }
+
+    BPTreeNode* root = load_bptree(indfile, NULL);
+    fclose(indfile);
+    if (root == NULL) {
+        return 1;
+    }
+    int n = 0;
+    for (BPTreeNode* leaf = first_leaf(root); leaf != NULL; leaf = leaf->type.leaf_node.next) {
+        n += leaf->num_vals;
+    }
+    if (n != header->row_count) {
+        free_node(root);
+        return 1;
+    }
+    *values = malloc((n > 0 ? n : 1) * sizeof(int));
+    *positions = malloc((n > 0 ? n : 1) * sizeof(int));
+    if (!*values || !*positions) {
+        perror("Memory allocation failed");
+        free(*values);
+        free(*positions);
+        free_node(root);
+        return -1;
+    }
+    // the leaf chain already is in value order
+    int k = 0;
+    for (BPTreeNode* leaf = first_leaf(root); leaf != NULL; leaf = leaf->type.leaf_node.next) {
+        for (int i = 0; i < leaf->num_vals; i++) {
+            (*values)[k] = leaf->type.leaf_node.vals[i];
+            (*positions)[k] = leaf->type.leaf_node.positions[i];
+            k++;
+        }
+    }
+    free_node(root);
+    *count = n;
+    return 0;
+}
+
+static void index_order_free(IndexOrder* order) {
+    free(order->values);
+    free(order->positions);
+    free(order);
+}
+
+/**
+ * Whether order was loaded from the index file as it is now (st) and covers
+ * every row of header.
+ */
+static bool index_order_current(const IndexOrder* order, const struct stat* st, const ColumnHeader* header) {
+    return order->file_size == st->st_size && order->count == header->row_count
+        && order->mtime.tv_sec == st->st_mtim.tv_sec && order->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/**
+ * The cache link holding the order of index file path, or the link past
+ * the end. Called with index_orders_mutex held.
+ */
+static IndexOrder** index_order_find(const char* path) {
+    IndexOrder** link = &index_orders;
+    while (*link != NULL && strcmp((*link)->path, path) != 0) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+/**
+ * Takes the order at link out of the cache; it is freed once its last user
+ * releases it. Called with index_orders_mutex held.
+ */
+static void index_order_drop(IndexOrder** link) {
+    IndexOrder* order = *link;
+    *link = order->next;
+    if (--order->refs == 0) {
+        index_order_free(order);
+    }
+}
+
+/**
+ * Empties the index order cache. Orders still in use are freed by their
+ * last user.
+ */
+void index_orders_clear(void) {
+    pthread_mutex_lock(&index_orders_mutex);
+    while (index_orders != NULL) {
+        index_order_drop(&index_orders);
+    }
+    pthread_mutex_unlock(&index_orders_mutex);
+}
+
+/**
+ * The index order of colname, from the cache or loaded into it. NULL if the
+ * column has no usable index. Release it with index_order_release().
+ */
+static IndexOrder* index_order_acquire(char* colname) {
+    ColumnHeader header;
+    if (read_column_header(colname, &header) != 0) {
+        return NULL;
+    }
+    char* fullpath = makePath(colname, _COLUMN);
+    if (!fullpath) {
+        return NULL;
+    }
+    strcat(fullpath, ".txt");
+    char* indexname = createIndexName(fullpath);
+    free(fullpath);
+    if (!indexname) {
+        return NULL;
+    }
+    struct stat st;
+    if (stat(indexname, &st) != 0) {
+        free(indexname);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&index_orders_mutex);
+    IndexOrder** link = index_order_find(indexname);
+    IndexOrder* order = *link;
+    if (order != NULL && index_order_current(order, &st, &header)) {
+        // move it to the front, as the most recently used
+        *link = order->next;
+        order->next = index_orders;
+        index_orders = order;
+        order->refs++;
+        pthread_mutex_unlock(&index_orders_mutex);
+        free(indexname);
+        return order;
+    }
+    if (order != NULL) {
+        // the index was rewritten or the column grew since it was loaded
+        index_order_drop(link);
+    }
+    pthread_mutex_unlock(&index_orders_mutex);
+
+    order = calloc(1, sizeof(IndexOrder));
+    if (!order) {
+        perror("Memory allocation failed");
+        free(indexname);
+        return NULL;
+    }
+    if (load_index_order(indexname, &header, &order->values, &order->positions, &order->count) != 0) {
+        free(order);
+        free(indexname);
+        return NULL;
+    }
+    strncpy(order->path, indexname, sizeof(order->path) - 1);
+    free(indexname);
+    order->file_size = st.st_size;
+    order->mtime = st.st_mtim;
+    order->refs = 2;
+    pthread_mutex_lock(&index_orders_mutex);
+    // another thread may have loaded the same index meanwhile
+    link = index_order_find(order->path);
+    if (*link != NULL && index_order_current(*link, &st, &header)) {
+        IndexOrder* loaded = *link;
+        loaded->refs++;
+        pthread_mutex_unlock(&index_orders_mutex);
+        index_order_free(order);
+        return loaded;
+    }
+    if (*link != NULL) {
+        index_order_drop(link);
+    }
+    order->next = index_orders;
+    index_orders = order;
+    // evict the least recently used beyond the cache size
+    int cached = 0;
+    for (link = &index_orders; *link != NULL; ) {
+        if (++cached > INDEX_ORDER_CACHE_SIZE) {
+            index_order_drop(link);
+        } else {
+            link = &(*link)->next;
+        }
+    }
+    pthread_mutex_unlock(&index_orders_mutex);
+    return order;
+}
+
+static void index_order_release(IndexOrder* order) {
+    pthread_mutex_lock(&index_orders_mutex);
+    bool last = --order->refs == 0;
+    pthread_mutex_unlock(&index_orders_mutex);
+    if (last) {
+        index_order_free(order);
+    }
+}
+
+/**
+ * Like join_input, but in join key order and without sorting: either the
+ * fetched values already are ascending, or the column they were fetched
+ * from (vvector->filepath) has an index whose order is filtered down to the
+ * rows of pvector. Both arrays of input are allocated here.
+ * Returns 1 if neither applies.
+ */
+int join_input_ordered(CatalogEntry* vvector, CatalogEntry* pvector, JoinInput* input) {
+    if (join_input(vvector, pvector, input) != 0) {
+        return -1;
+    }
+    if (vvector->valid != NULL) {
+        // without its nulls the input is a copy already, but no longer
+        // every row of pvector, which the index route needs
+        if (join_input_sorted(input)) {
+            return 0;
+        }
+        free(input->values);
+        free(input->positions);
+        return 1;
+    }
+    if (join_input_sorted(input)) {
+        int* values = malloc((input->count > 0 ? input->count : 1) * sizeof(int));
+        if (!values) {
+            perror("Memory allocation failed");
+            free(input->positions);
+            return -1;
+        }
+        memcpy(values, input->values, input->count * sizeof(int));
+        input->values = values;
+        return 0;
+    }
+
+    // the index route needs every row of pvector exactly once, in row order
+    bool ascending = true;
+    for (int i = 1; i < input->count && ascending; i++) {
+        ascending = input->positions[i] > input->positions[i - 1];
+    }
+    IndexOrder* order = NULL;
+    if (!ascending || vvector->filepath[0] == '\0' || input->count != vvector->size
+            || (order = index_order_acquire(vvector->filepath)) == NULL) {
+        free(input->positions);
+        return 1;
+    }
+    const int* index_values = order->values;
+    const int* index_positions = order->positions;
+    int num_items = order->count;
+
+    uint64_t* rows = calloc((num_items + 63) / 64 + 1, sizeof(uint64_t));
+    int* values = malloc((input->count > 0 ? input->count : 1) * sizeof(int));
+    int* positions = malloc((input->count > 0 ? input->count : 1) * sizeof(int));
+    if (!rows || !values || !positions) {
+        perror("Memory allocation failed");
+        free(rows);
+        free(values);
+        free(positions);
+        index_order_release(order);
+        free(input->positions);
+        return -1;
+    }
+    for (int i = 0; i < input->count; i++) {
+        if (input->positions[i] < num_items) {
+            rows[input->positions[i] / 64] |= 1ULL << (input->positions[i] % 64);
+        }
+    }
+    int n = 0;
+    for (int k = 0; k < num_items; k++) {
+        int pos = index_positions[k];
+        if (pos >= 0 && pos < num_items && (rows[pos / 64] >> (pos % 64)) & 1) {
+            values[n] = index_values[k];
+            positions[n] = pos;
+            n++;
+        }
+    }
+    free(rows);
+    index_order_release(order);
+    free(input->positions);
+    input->values = values;
+    input->positions = positions;
+    input->count = n;
+    return 0;
+}
+
+/**
+ * True if kvector was fetched from a column kept in key order: the sort
+ * column of a table clustered on it, or a column whose binary file has
+ * only ever been appended to in order.
+ */
+bool group_keys_clustered(CatalogEntry* kvector, ClientContext* context) {
+    if (kvector->filepath[0] == '\0') {
+        return false;
+    }
+    char* path = makePath(kvector->filepath, _COLUMN);
+    if (!path) {
+        return false;
+    }
+    strcat(path, ".txt");
+    bool clustered = false;
+    for (int i = 0; i < context->num_tables && !clustered; i++) {
+        Tb* table = context->tables[i];
+        clustered = table->clustered && strcmp(table->sort_col_path, path) == 0;
+    }
+    free(path);
+    ColumnHeader header;
+    if (!clustered && read_column_header(kvector->filepath, &header) == 0) {
+        clustered = header.sorted;
+    }
+    return clustered;
+}
+
+/**
+ * k,v=groupby(keys,vals,agg) groups the value vector vals by the key vector
+ * keys (aligned row for row, as fetched through the same positions) and
+ * aggregates every group with agg: sum, avg, count, min or max. k gets the
+ * distinct keys and v the aggregate of each.
+ */
+DbOperator* parse_group_by(char* query_command, char* handle, message* send_message,
+        CatalogHashtable* variable_pool, ClientContext* context) {
     if (strncmp(query_command, "(", 1) != 0) {
         send_message->status = UNKNOWN_COMMAND;
         return NULL;
     }
     query_command++;
     char** command_index = &query_command;
-    
-    
-    // parse parameters
-    char* arg1 = next_token(command_index, &send_message->status);
-    char* arg2 = next_token(command_index, &send_message->status);
-    arg1 = trim_parenthesis(arg1);
-    arg2 = trim_parenthesis(arg2);
+    char** handle_index = &handle;
+    char* handle_keys = next_token(handle_index, &send_message->status);
+    char* handle_values = next_token(handle_index, &send_message->status);
+
+    char* keys_name = next_token(command_index, &send_message->status);
+    char* values_name = next_token(command_index, &send_message->status);
+    char* aggregate = next_token(command_index, &send_message->status);
+    if (!handle_keys || !handle_values || !keys_name || !values_name || !aggregate) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    aggregate = trim_parenthesis(aggregate);
+    AggregateType type;
+    if (strcmp(aggregate, "sum") == 0) {
+        type = AGG_SUM;
+    } else if (strcmp(aggregate, "avg") == 0) {
+        type = AGG_AVG;
+    } else if (strcmp(aggregate, "count") == 0) {
+        type = AGG_COUNT;
+    } else if (strcmp(aggregate, "min") == 0) {
+        type = AGG_MIN;
+    } else if (strcmp(aggregate, "max") == 0) {
+        type = AGG_MAX;
+    } else {
+        log_err("Unknown group by aggregate: %s\n", aggregate);
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
 
-    CatalogEntry* vvector1 = get(variable_pool, arg1);
-    CatalogEntry* vvector2 = get(variable_pool, arg2);
+    CatalogEntry* kvector = get_result(variable_pool, keys_name);
+    CatalogEntry* vvector = get_result(variable_pool, values_name);
+    if (!kvector || !vvector || is_position_result(kvector) || is_position_result(vvector)
+            || kvector->has_value || vvector->has_value) {
+        log_err("groupby needs two value vectors\n");
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+    int n = kvector->size < vvector->size ? kvector->size : vvector->size;
+    int* keys = kvector->bitvector;
+    int* values = vvector->bitvector;
+    if (kvector->valid != NULL || vvector->valid != NULL) {
+        // rows whose key or value is null are in no group
+        keys = malloc((n > 0 ? n : 1) * sizeof(int));
+        values = malloc((n > 0 ? n : 1) * sizeof(int));
+        if (!keys || !values) {
+            perror("Memory allocation failed");
+            free(keys);
+            free(values);
+            return NULL;
+        }
+        int count = 0;
+        for (int i = 0; i < n; i++) {
+            if (!arith_is_null(kvector->valid, i) && !arith_is_null(vvector->valid, i)) {
+                keys[count] = kvector->bitvector[i];
+                values[count++] = vvector->bitvector[i];
+            }
+        }
+        n = count;
+    }
+    GroupResult result;
+    // keys from a clustered column are grouped in one streaming pass; the
+    // pass gives up if a fetch through unordered positions shuffled them
+    int ret = group_keys_clustered(kvector, context)
+        ? sorted_group_by(keys, values, n, type, &result) : 1;
+    if (ret == 1) {
+        ret = hash_group_by(keys, values, n, type, &result);
+    }
+    if (keys != kvector->bitvector) {
+        free(keys);
+        free(values);
+    }
+    if (ret != 0) {
+        return NULL;
+    }
 
-    CatalogEntry* retvector = (CatalogEntry *) malloc(sizeof(CatalogEntry));
-    if (!retvector) {
+    CatalogEntry* cat1 = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+    CatalogEntry* cat2 = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+    // counts, minimums, maximums and sums that fit in an int are ordinary
+    // value vectors, averages and larger sums are only held as doubles
+    bool as_ints = type != AGG_AVG;
+    for (int i = 0; i < result.count && as_ints; i++) {
+        as_ints = result.values[i] >= INT_MIN && result.values[i] <= INT_MAX;
+    }
+    int* ints = as_ints ? malloc((result.count > 0 ? result.count : 1) * sizeof(int)) : NULL;
+    if (!cat1 || !cat2 || (as_ints && !ints)) {
         perror("Failed to allocate memory for CatalogEntry");
+        free(cat1);
+        free(cat2);
+        free(ints);
+        group_result_free(&result);
         return NULL;
     }
+    strcpy(cat1->name, handle_keys);
+    cat1->bitvector = result.keys;
+    cat1->size = result.count;
+    cat1->bitv_capacity = (result.count > 0 ? result.count : 1) * sizeof(int);
+    cat1->in_vpool = true;
+    strcpy(cat2->name, handle_values);
+    cat2->size = result.count;
+    if (ints != NULL) {
+        for (int i = 0; i < result.count; i++) {
+            ints[i] = (int) result.values[i];
+        }
+        free(result.values);
+        cat2->bitvector = ints;
+        cat2->bitv_capacity = (result.count > 0 ? result.count : 1) * sizeof(int);
+    } else {
+        cat2->dvector = result.values;
+    }
+    cat2->in_vpool = true;
+    put(variable_pool, *cat1);
+    put(variable_pool, *cat2);
+    free(cat1);
+    free(cat2);
 
-    int count = vvector1->size;
-    retvector->bitv_capacity = sizeof(int) * count;
-    retvector->bitvector = (int*) malloc(retvector->bitv_capacity);
+    DbOperator* dbo = malloc(sizeof(DbOperator));
+    return dbo;
+}
 
-    for (int i=0; i<count; i++) {
-        if ((vvector1->bitvector[i]) != INT_MIN && (vvector2->bitvector[i]) != INT_MIN 
-        && (vvector1->bitvector[i]) != INT_MAX && (vvector2->bitvector[i]) != INT_MAX) {
-            retvector->bitvector[i] = (vvector1->bitvector[i]) - (vvector2->bitvector[i]);
+/**
+ * Directory of the database vvector's values were fetched from, where a
+ * join that does not fit in memory spills its partitions. Caller frees.
+ */
+char* join_spill_dir(CatalogEntry* vvector) {
+    char dbname[MAX_SIZE_NAME];
+    strcpy(dbname, vvector->filepath);
+    char* dot = strchr(dbname, '.');
+    if (dot == NULL) {
+        return strdup(".");
+    }
+    *dot = '\0';
+    return makePath(dbname, _DB);
+}
+
+/**
+ * p1,p2=join(f1,p1,f2,p2,algorithm) stores the rows of p1 and p2 whose
+ * values in f1 and f2 are equal as two aligned position lists.
+ */
+DbOperator* parse_join(char* query_command, char* handle, message* send_message, CatalogHashtable* variable_pool) {
+    if (strncmp(query_command, "(", 1) != 0) {
+        send_message->status = UNKNOWN_COMMAND;
+        return NULL;
+    }
+    query_command++;
+    char** command_index = &query_command;
+    char** handle_index = &handle;
+    char* handle_left = next_token(handle_index, &send_message->status);
+    char* handle_right = next_token(handle_index, &send_message->status);
+
+    char* vals1 = next_token(command_index, &send_message->status);
+    char* pos1 = next_token(command_index, &send_message->status);
+    char* vals2 = next_token(command_index, &send_message->status);
+    char* pos2 = next_token(command_index, &send_message->status);
+    char* algorithm = next_token(command_index, &send_message->status);
+    if (!handle_left || !handle_right || !algorithm) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    algorithm = trim_parenthesis(algorithm);
+
+    CatalogEntry* vvector1 = get_result(variable_pool, vals1);
+    CatalogEntry* pvector1 = get_result(variable_pool, pos1);
+    CatalogEntry* vvector2 = get_result(variable_pool, vals2);
+    CatalogEntry* pvector2 = get_result(variable_pool, pos2);
+    if (!vvector1 || !pvector1 || !vvector2 || !pvector2) {
+        log_err("Unknown join input\n");
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+
+    JoinInput left;
+    JoinInput right;
+    JoinResult result;
+    // inputs that are already in key order are merged in one pass instead
+    // of being hashed
+    bool merge = false;
+    if (strcmp(algorithm, "hash") == 0 || strcmp(algorithm, "merge") == 0) {
+        merge = join_input_ordered(vvector1, pvector1, &left) == 0;
+        if (merge && join_input_ordered(vvector2, pvector2, &right) != 0) {
+            free(left.values);
+            free(left.positions);
+            merge = false;
         }
-        else {
-            retvector->bitvector[i] = INT_MIN;
+    }
+    if (!merge) {
+        if (join_input(vvector1, pvector1, &left) != 0) {
+            return NULL;
+        }
+        if (join_input(vvector2, pvector2, &right) != 0) {
+            if (vvector1->valid != NULL) {
+                free(left.values);
+            }
+            free(left.positions);
+            return NULL;
         }
     }
+    int ret = join_result_init(&result, left.count < right.count ? left.count : right.count);
+    if (ret == 0) {
+        if (merge) {
+            ret = merge_join(&left, &right, &result);
+        } else if (strcmp(algorithm, "hash") == 0 || strcmp(algorithm, "merge") == 0) {
+            char* spill_dir = join_spill_dir(vvector1);
+            ret = spill_dir ? grace_hash_join(&left, &right, spill_dir, JOIN_MEMORY_BUDGET, &result) : -1;
+            free(spill_dir);
+        } else if (strcmp(algorithm, "nested-loop") == 0) {
+            ret = nested_loop_join(&left, &right, &result);
+        } else {
+            log_err("Unknown join algorithm: %s\n", algorithm);
+            send_message->status = INCORRECT_FORMAT;
+            ret = -1;
+        }
+    }
+    if (merge || vvector1->valid != NULL) {
+        free(left.values);
+    }
+    if (merge || vvector2->valid != NULL) {
+        free(right.values);
+    }
+    free(left.positions);
+    free(right.positions);
+    if (ret != 0) {
+        join_result_free(&result);
+        return NULL;
+    }
 
-    strcpy(retvector->name, handle);
-    retvector->size = count;
-    retvector->in_vpool = true;
-    retvector->has_value = false;
-
-    put(variable_pool, *retvector);
+    CatalogEntry* cat1 = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+    CatalogEntry* cat2 = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+    if (!cat1 || !cat2) {
+        perror("Failed to allocate memory for CatalogEntry");
+        free(cat1);
+        free(cat2);
+        join_result_free(&result);
+        return NULL;
+    }
+    strcpy(cat1->name, handle_left);
+    positions_from_join(cat1, result.left, result.count, pvector1->num_rows);
+    cat1->in_vpool = true;
+    strcpy(cat2->name, handle_right);
+    positions_from_join(cat2, result.right, result.count, pvector2->num_rows);
+    cat2->in_vpool = true;
+    put(variable_pool, *cat1);
+    put(variable_pool, *cat2);
+    free(cat1);
+    free(cat2);
 
     DbOperator* dbo = malloc(sizeof(DbOperator));
     return dbo;
 }
 
-// TODO: MILESTONE 2 BATCHING QUERIES!!!
-
-
-// Helper functions for batch processing
-
 int get_select_obj(char* filename, ClientContext* context) {
     for (int i=0; i<20; i++) {
         if (strcmp(filename, context->selects[i])) {
@@ -3386,6 +4797,12 @@ DbOperator* batch_select_add(char* query_command, char* handle, message* send_me
     query_command++;
     char** command_index = &query_command;
 
+    if (context->num_selects == (int) (sizeof(context->selects) / sizeof(SelectObject*))) {
+        log_err("Batch is full\n");
+        send_message->status = EXECUTION_ERROR;
+        return NULL;
+    }
+
     SelectObject* retselect = (SelectObject*) malloc(sizeof(SelectObject));
     retselect->results_capacity = START_CAPACITY * sizeof(int);
     retselect->results = malloc(retselect->results_capacity);
@@ -3409,7 +4826,7 @@ DbOperator* batch_select_add(char* query_command, char* handle, message* send_me
         ihigh = atoi(high);
     }
 
-    strcpy(context->batch_identifier, arg1); //dont need to keep updating?
+    strcpy(retselect->column, arg1);
 
     retselect->maxval = ihigh;
     retselect->minval = ilow;
@@ -3422,22 +4839,111 @@ DbOperator* batch_select_add(char* query_command, char* handle, message* send_me
     return dbo;
 }
 
-DbOperator* parse_batch_execute(char* query_command, message* send_message, CatalogEntry* variable_pool, ClientContext* context) {
-    if (strncmp(query_command, "()", 2) != 0) {
-        send_message->status = UNKNOWN_COMMAND;
+/**
+ * Zeroed result bitmaps of num_rows bits for each of num_selects selects.
+ */
+static uint64_t** batch_alloc_bitmaps(int num_selects, int num_rows) {
+    uint64_t** bitmaps = calloc(num_selects > 0 ? num_selects : 1, sizeof(uint64_t*));
+    if (!bitmaps) {
+        perror("Memory allocation failed");
         return NULL;
     }
+    for (int i=0; i<num_selects; i++) {
+        bitmaps[i] = calloc((num_rows + 63) / 64 + 1, sizeof(uint64_t));
+        if (!bitmaps[i]) {
+            perror("Memory allocation failed");
+            for (int j=0; j<i; j++) {
+                free(bitmaps[j]);
+            }
+            free(bitmaps);
+            return NULL;
+        }
+    }
+    return bitmaps;
+}
 
-    query_command++;
-    query_command++;
-    char** command_index = &query_command;
+/**
+ * Stores each select's bitmap as the positions under its handle. The
+ * entries take over the bitmaps.
+ */
+static DbOperator* batch_store_bitmaps(SelectObject** selects, int num_selects, uint64_t** bitmaps, int num_rows, CatalogHashtable* variable_pool) {
+    for (int i=0; i<num_selects; i++) {
+        SelectObject* obj_in_question = selects[i];
+        CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+        if (!cat) {
+            perror("Failed to allocate memory for CatalogEntry");
+            for (int j=i; j<num_selects; j++) {
+                free(bitmaps[j]);
+            }
+            free(bitmaps);
+            return NULL;
+        }
+        strcpy(cat->name, obj_in_question->handle);
+        positions_from_bitmap(cat, bitmaps[i], num_rows);
+        cat->in_vpool = true;
+        put(variable_pool, *cat);
+        free(cat);
+    }
+    free(bitmaps);
+    DbOperator* dbo = malloc(sizeof(DbOperator));
+    return dbo;
+}
 
-    char* arg1 = context->batch_identifier;
+/**
+ * Runs the batched selects on the binary column bin in one pass,
+ * evaluating all of their ranges a tile at a time (or by binary search if
+ * the column is sorted), and stores each select's positions under its
+ * handle. Closes bin.
+ */
+static DbOperator* batch_execute_binary(ColumnFile* bin, SelectObject** selects, int num_selects, CatalogHashtable* variable_pool, bool parallel) {
+    int count = bin->count;
+    uint64_t** bitmaps = batch_alloc_bitmaps(num_selects, count);
+    if (!bitmaps) {
+        column_file_close(bin);
+        return NULL;
+    }
+    if (bin->header->sorted) {
+        // a sorted column answers each range with two binary searches
+        for (int i = 0; i < num_selects; i++) {
+            select_binary_range(bin, selects[i]->minval, selects[i]->maxval, bitmaps[i], 0, count);
+        }
+    } else {
+        batch_select_bitmaps(bin->values, count, selects, num_selects, bitmaps, parallel);
+    }
+    column_file_close(bin);
+    return batch_store_bitmaps(selects, num_selects, bitmaps, count, variable_pool);
+}
+
+/**
+ * Runs the batched selects through the index order of their column
+ * (values ascending, and the row of each) instead of scanning it, and
+ * stores each select's positions under its handle.
+ */
+static DbOperator* batch_execute_index(const IndexOrder* order, SelectObject** selects, int num_selects, CatalogHashtable* variable_pool) {
+    uint64_t** bitmaps = batch_alloc_bitmaps(num_selects, order->count);
+    if (!bitmaps) {
+        return NULL;
+    }
+    batch_select_index(order->values, order->positions, order->count, selects, num_selects, bitmaps);
+    return batch_store_bitmaps(selects, num_selects, bitmaps, order->count, variable_pool);
+}
+
+/**
+ * Runs the batched selects on column arg1 in one scan of the column.
+ */
+static DbOperator* batch_select_column(char* arg1, SelectObject** selects, int num_selects, CatalogEntry* variable_pool) {
     char* name = getName(arg1);
     char* catpath = makePath(arg1, _COLUMN);
 
     char* fullpath = catpath;
     strcat(fullpath, ".txt");
+
+    // Binary column: evaluate every batched select in one tiled pass over the mapping
+    ColumnFile* bin = open_binary_column(arg1, (CatalogHashtable*) variable_pool);
+    if (bin != NULL) {
+        return batch_execute_binary(bin, selects, num_selects, (CatalogHashtable*) variable_pool, false);
+    }
+
     // open column file
     FILE* file = fopen(fullpath, "r");
     if (!file) {
@@ -3471,8 +4977,8 @@ DbOperator* parse_batch_execute(char* query_command, message* send_message, Cata
         // For our bitvector, false === INT_MIN and true === INT_MAX (this allows us to use the bitvector object for a value vector)
 
         // NOW WE CHECK EACH SELECT OBJECT IN THE CLIENT CONTEXT THIS VALUE
-        for (int i=0; i<context->num_selects; i++) {
-            SelectObject* obj_in_question = context->selects[i];
+        for (int i=0; i<num_selects; i++) {
+            SelectObject* obj_in_question = selects[i];
             int ihigh = obj_in_question->maxval;
             int ilow = obj_in_question->minval;
 
@@ -3483,18 +4989,18 @@ DbOperator* parse_batch_execute(char* query_command, message* send_message, Cata
             else {
                 val = INT_MIN;
             }
-            if (count * sizeof(int) < context->selects[i]->results_capacity) {
-                context->selects[i]->results[count] = val;
+            if (count * sizeof(int) < obj_in_question->results_capacity) {
+                obj_in_question->results[count] = val;
             }
             else {
-                int* rescopy = (int*) realloc(context->selects[i]->results, context->selects[i]->results_capacity*2);
-                context->selects[i]->results_capacity*=2;
+                int* rescopy = (int*) realloc(obj_in_question->results, obj_in_question->results_capacity*2);
+                obj_in_question->results_capacity*=2;
                 if (rescopy == NULL) {
                     perror("Allocation failure");
                     return NULL;
                 } else {
-                    context->selects[i]->results = rescopy;
-                    context->selects[i]->results[count] = val;
+                    obj_in_question->results = rescopy;
+                    obj_in_question->results[count] = val;
                 }
             }
         }
@@ -3502,9 +5008,9 @@ DbOperator* parse_batch_execute(char* query_command, message* send_message, Cata
     }
         
 
-    for (int i=0; i<context->num_selects; i++) {
-        SelectObject* obj_in_question = context->selects[i];
-        CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
+    for (int i=0; i<num_selects; i++) {
+        SelectObject* obj_in_question = selects[i];
+        CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
         cat->bitv_capacity = count * sizeof(int);
         cat->bitvector = (int*) malloc(cat->bitv_capacity);
         if (!cat) {
@@ -3517,7 +5023,8 @@ DbOperator* parse_batch_execute(char* query_command, message* send_message, Cata
             cat->bitvector[j] = obj_in_question->results[j];
         }
         cat->in_vpool = true;
-        put(variable_pool, *cat);
+        positions_from_markers(cat);
+        put((CatalogHashtable*) variable_pool, *cat);
     }
 
     fclose(file);
@@ -3530,7 +5037,6 @@ DbOperator* parse_batch_execute(char* query_command, message* send_message, Cata
 void* threadFunction2(void* arg) {
     ThreadArgs* threadArgs = (ThreadArgs*) arg;
 
-
     // Open the file (consider thread-safe mechanisms or separate file pointers)
     FILE* file = fopen(threadArgs->filepath, "r");
     if (!file) {
@@ -3565,25 +5071,16 @@ void* threadFunction2(void* arg) {
                 line[len - 1] = '\0';
             }
             int lineval = atoi(line);
-            // Now 'line' contains the current line from the file without the newline character
-            // For our bitvector, false === INT_MIN and true === INT_MAX (this allows us to use the bitvector object for a value vector)
-            // NOW WE CHECK EACH SELECT OBJECT IN THE CLIENT CONTEXT THIS VALUE
-            // Apply select criteria for each SelectObject
+            // Apply select criteria for each SelectObject. Bit row of each
+            // select's segment is set if the value qualifies; the segments
+            // belong to this morsel alone, so nothing is shared or resized
+            int row = currentLine - (threadArgs->startLine - 1);
+            uint64_t bit = 1ULL << (row % 64);
             for (int j = 0; j < threadArgs->numSelects; j++) {
                 SelectObject* select = threadArgs->selects[j];
-                int val = (lineval >= select->minval && lineval < select->maxval) ? INT_MAX : INT_MIN;
-                if (currentLine * sizeof(int) < select->results_capacity) {
-                    select->results[currentLine] = val; // Store result; ensure this array is pre-allocated
-                } else {
-                    int* rescopy = (int*) realloc(select->results, select->results_capacity*2);
-                    select->results_capacity*=2;
-                    if (rescopy == NULL) {
-                        perror("Allocation failure");
-                        return NULL;
-                    } else {
-                        select->results = rescopy;
-                        select->results[currentLine] = val;
-                    }
+                uint64_t* segment = threadArgs->bitmap + (size_t) j * threadArgs->segment_words;
+                if (lineval >= select->minval && lineval < select->maxval) {
+                    segment[row / 64] |= bit;
                 }
             }
             currentLine++;
@@ -3611,26 +5108,46 @@ void* threadFunction2(void* arg) {
     return NULL;
 }
 
-DbOperator* parse_batch_execute_multithread(char* query_command, message* send_message, CatalogEntry* variable_pool, ClientContext* context) {
-    if (strncmp(query_command, "()", 2) != 0) {
-        send_message->status = UNKNOWN_COMMAND;
-        return NULL;
-    }
-
-    query_command++;
-    query_command++;
-    char** command_index = &query_command;
+/**
+ * Runs threadFunction2 on one morsel of rows [start, end) for the worker
+ * pool. Line numbering for text columns is the same as in select_morsel.
+ * The morsel writes to its own block of args->segments: one segment of
+ * segment_words per select.
+ */
+void batch_morsel(void* arg, int start, int end) {
+    ThreadArgs local = *(ThreadArgs*) arg;
+    local.startLine = start;
+    local.endLine = end;
+    size_t morsel = (start - 1) / MORSEL_SIZE;
+    local.bitmap = local.segments + morsel * local.numSelects * local.segment_words;
+    if (local.lineOffsets != NULL) {
+        local.endLine = end - 1;
+        local.startOffset = local.lineOffsets[start];
+        local.endOffset = local.lineOffsets[end - 1];
+    }
+    threadFunction2(&local);
+}
 
-    int threadCount = 4; // Number of threads
-    pthread_t threads[threadCount];
-    ThreadArgs args[threadCount];
+/**
+ * Runs the batched selects on column arg1 in one scan of the column, its
+ * morsels on the worker pool.
+ */
+static DbOperator* batch_select_column_multithread(char* arg1, SelectObject** selects, int num_selects, CatalogEntry* variable_pool) {
+    ThreadArgs args;
+    memset(&args, 0, sizeof(ThreadArgs));
 
-    char* arg1 = context->batch_identifier;
     char* name = getName(arg1);
     char* catpath = makePath(arg1, _COLUMN);
 
     char* fullpath = catpath;
     strcat(fullpath, ".txt");
+
+    // Binary column: the same tiled pass, its morsels on the worker pool
+    ColumnFile* bin = open_binary_column(arg1, (CatalogHashtable*) variable_pool);
+    if (bin != NULL) {
+        return batch_execute_binary(bin, selects, num_selects, (CatalogHashtable*) variable_pool, true);
+    }
+
     // open column file
     FILE* file = fopen(fullpath, "r");
     if (!file) {
@@ -3647,11 +5164,11 @@ DbOperator* parse_batch_execute_multithread(char* query_command, message* send_m
         if (strncmp(line, "\0", 1) == 0) {
             break;
         }
-        if (lineCount < offset_capacity) {
+        if (lineCount * (int) sizeof(long) < offset_capacity) {
             lineOffsets[lineCount] = currentOffset;
         }
         else {
-            long* offsetscopy = (int*) realloc(lineOffsets, offset_capacity *2);
+            long* offsetscopy = (long*) realloc(lineOffsets, offset_capacity *2);
             if (offsetscopy == NULL) {
                 perror("Allocation failure");
                 return NULL;
@@ -3668,67 +5185,365 @@ DbOperator* parse_batch_execute_multithread(char* query_command, message* send_m
     
     fclose(file);
 
-    int nums[5];
-    nums[0] = 1;
-    nums[1] = lineCount / 4;
-    nums[2] = (lineCount / 4) * 2;
-    nums[3] = (lineCount / 4) * 3;
-    nums[4] = lineCount-1;
+    // every morsel gets a private block of zeroed segments, one per select,
+    // each starting on a cache line; lineCount includes the header line
+    int num_rows = lineCount > 0 ? lineCount - 1 : 0;
+    int num_morsels = (num_rows + MORSEL_SIZE - 1) / MORSEL_SIZE;
+    int segment_words = ((MORSEL_SIZE + 63) / 64 + 7) / 8 * 8;
+    size_t segments_size = (size_t) (num_morsels > 0 ? num_morsels : 1) * num_selects * segment_words * sizeof(uint64_t);
+    void* segments = NULL;
+    if (posix_memalign(&segments, 64, segments_size > 0 ? segments_size : 64) != 0) {
+        perror("Memory allocation failed");
+        free(lineOffsets);
+        return NULL;
+    }
+    memset(segments, 0, segments_size);
+
+    strcpy(args.filepath, fullpath);
+    args.values = NULL;
+    args.lineOffsets = lineOffsets;
+    args.numSelects = num_selects;
+    args.selects = selects;
+    args.segments = segments;
+    args.segment_words = segment_words;
+    thread_pool_run(batch_morsel, &args, 1, lineCount, MORSEL_SIZE);
+    free(lineOffsets);
+
+    // stitch each select's segments together into its result
+    for (int i=0; i<num_selects; i++) {
+        SelectObject* obj_in_question = selects[i];
+        uint64_t* bitmap = calloc((num_rows + 63) / 64 + 1, sizeof(uint64_t));
+        CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+        if (!bitmap || !cat) {
+            perror("Failed to allocate memory for CatalogEntry");
+            free(bitmap);
+            free(cat);
+            free(segments);
+            return NULL;
+        }
+        for (int m=0; m<num_morsels; m++) {
+            int first = m * (MORSEL_SIZE / 64);
+            int words = ((num_rows - m * MORSEL_SIZE < MORSEL_SIZE ? num_rows - m * MORSEL_SIZE : MORSEL_SIZE) + 63) / 64;
+            memcpy(bitmap + first, (uint64_t*) segments + ((size_t) m * num_selects + i) * segment_words,
+                   words * sizeof(uint64_t));
+        }
+        strcpy(cat->name, obj_in_question->handle);
+        positions_from_bitmap(cat, bitmap, num_rows);
+        cat->in_vpool = true;
+        put((CatalogHashtable*) variable_pool, *cat);
+        free(cat);
+    }
+    free(segments);
+
+    DbOperator* dbo = malloc(sizeof(DbOperator));
+    return dbo;
 
+}
 
-    
-    // Split the file into portions and initialize thread arguments
-    for (int i = 0; i < threadCount; ++i) {
-        args[i].startLine = nums[i];
-        args[i].endLine = nums[i+1];
-        args[i].startOffset = lineOffsets[nums[i]]; // Calculate start line for this thread
-        args[i].endOffset = lineOffsets[nums[i+1]]; // Calculate end line for this thread
-        //fprintf(stdout, "THREAD %i is %i (offset %i) to %i (offset %i)\n", i, nums[i], lineOffsets[nums[i]], nums[i+1], lineOffsets[nums[i+1]]);
-        strcpy(args[i].filepath, fullpath);
-        //args[i].bitvector = malloc((lineOffsets[nums[i+1]] - lineOffsets[nums[i]]) * sizeof(int));
-        args[i].numSelects = context->num_selects;
-        args[i].selects = context->selects;
-        // Initialize other necessary fields
+/**
+ * BatchFetch
+ * A queued "handle=fetch(column,positions)" of a batch, and whether it is
+ * gathered in the batch's shared pass over its column.
+ **/
+typedef struct BatchFetch {
+    char handle[MAX_SIZE_NAME];
+    char column[MAX_SIZE_NAME];
+    char positions[MAX_SIZE_NAME];
+    bool gathered;
+} BatchFetch;
 
-        // Create the thread
-        if (pthread_create(&threads[i], NULL, threadFunction2, &args[i])) {
-            perror("Failed to create thread");
+/**
+ * Whether query_command is a select(col,low,high) on a column, the only
+ * command a batch evaluates in its shared scans. Everything else with a
+ * handle is queued until batch_execute().
+ */
+static bool batch_select_command(const char* query_command) {
+    if (strncmp(query_command, "select(", 7) != 0) {
+        return false;
+    }
+    const char* arg1 = query_command + 7;
+    const char* comma = strchr(arg1, ',');
+    if (comma == NULL || memchr(arg1, '.', comma - arg1) == NULL) {
+        return false;
+    }
+    int commas = 0;
+    for (const char* c = arg1; *c != '\0'; c++) {
+        commas += *c == ',';
+    }
+    return commas == 2;
+}
+
+/**
+ * Queues handle=query_command to run once the batch's selects are in.
+ */
+static int batch_queue_command(char* handle, char* query_command, ClientContext* context) {
+    if (context->num_batch_commands == (int) (sizeof(context->batch_commands) / sizeof(char*))) {
+        log_err("Batch is full\n");
+        return -1;
+    }
+    size_t len = strlen(handle) + strlen(query_command) + 2;
+    char* command = malloc(len);
+    if (!command) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    snprintf(command, len, "%s=%s", handle, query_command);
+    context->batch_commands[context->num_batch_commands++] = command;
+    return 0;
+}
+
+/**
+ * Whether the queued command assigns name.
+ */
+static bool batch_command_writes(const char* command, const char* name) {
+    const char* equals = strchr(command, '=');
+    size_t len = strlen(name);
+    return equals != NULL && (size_t) (equals - command) == len && strncmp(command, name, len) == 0;
+}
+
+/**
+ * Whether name is the handle or one of the arguments of the queued command.
+ */
+static bool batch_command_mentions(const char* command, const char* name) {
+    size_t len = strlen(name);
+    if (len == 0) {
+        return false;
+    }
+    for (const char* p = strstr(command, name); p != NULL; p = strstr(p + 1, name)) {
+        bool starts = p == command || strchr("=(, ", p[-1]) != NULL;
+        bool ends = p[len] == '\0' || strchr("=(), ", p[len]) != NULL;
+        if (starts && ends) {
+            return true;
         }
     }
+    return false;
+}
 
-    // Wait for threads and aggregate results
-    for (int i = 0; i < threadCount; ++i) {
-        pthread_join(threads[i], NULL);
+/**
+ * Splits a queued "handle=fetch(column,positions)" into fetch.
+ * Returns false for any other command.
+ */
+static bool batch_fetch_parse(const char* command, BatchFetch* fetch) {
+    const char* equals = strchr(command, '=');
+    if (equals == NULL || strncmp(equals + 1, "fetch(", 6) != 0) {
+        return false;
+    }
+    const char* column = equals + 7;
+    const char* comma = strchr(column, ',');
+    const char* close = comma != NULL ? strchr(comma, ')') : NULL;
+    if (close == NULL || equals - command >= MAX_SIZE_NAME || comma - column >= MAX_SIZE_NAME
+            || close - comma - 1 >= MAX_SIZE_NAME) {
+        return false;
+    }
+    memset(fetch, 0, sizeof(BatchFetch));
+    memcpy(fetch->handle, command, equals - command);
+    memcpy(fetch->column, column, comma - column);
+    memcpy(fetch->positions, comma + 1, close - comma - 1);
+    return true;
+}
+
+/**
+ * Gathers the queued fetches of context that read the positions of one of
+ * the batch's selects from a binary column, with one shared pass per
+ * column. A fetch is only moved ahead of the commands queued before it if
+ * none of them assigns its handle or its positions, or reads its handle.
+ * Gathered commands are freed and their slots set to NULL.
+ */
+static void batch_gather_fetches(ClientContext* context, CatalogHashtable* variable_pool) {
+    int num_commands = context->num_batch_commands;
+    if (num_commands == 0) {
+        return;
+    }
+    BatchFetch* fetches = calloc(num_commands, sizeof(BatchFetch));
+    CatalogEntry** positions = malloc(num_commands * sizeof(CatalogEntry*));
+    int** results = malloc(num_commands * sizeof(int*));
+    int* counts = malloc(num_commands * sizeof(int));
+    int* members = malloc(num_commands * sizeof(int));
+    if (!fetches || !positions || !results || !counts || !members) {
+        perror("Memory allocation failed");
+        free(fetches);
+        free(positions);
+        free(results);
+        free(counts);
+        free(members);
+        return;
     }
 
-    // TODO: GET RESULTS AND JOIN THEM
-        
-    for (int i=0; i<context->num_selects; i++) {
-        SelectObject* obj_in_question = context->selects[i];
-        CatalogEntry* cat = (CatalogEntry *) malloc(sizeof(CatalogEntry));
-        if (!cat) {
-            perror("Failed to allocate memory for CatalogEntry");
-            return NULL;
+    for (int k = 0; k < num_commands; k++) {
+        BatchFetch* fetch = &fetches[k];
+        if (!batch_fetch_parse(context->batch_commands[k], fetch)) {
+            continue;
         }
-        cat->bitv_capacity = lineCount * sizeof(int);
-        cat->bitvector = (int*) malloc(cat->bitv_capacity);
-        strcpy(cat->name, obj_in_question->handle);
-        cat->size = lineCount;
-        for (int j=0; j<lineCount; j++) {
-            cat->bitvector[j] = obj_in_question->results[j];
+        bool batched = false;
+        for (int i = 0; i < context->num_selects; i++) {
+            batched |= strcmp(context->selects[i]->handle, fetch->positions) == 0;
         }
-        cat->in_vpool = true;
-        put(variable_pool, *cat);
+        ColumnHeader header;
+        if (!batched || read_column_header(fetch->column, &header) != 0) {
+            continue;
+        }
+        bool independent = true;
+        for (int j = 0; j < k && independent; j++) {
+            char* earlier = context->batch_commands[j];
+            independent = !batch_command_writes(earlier, fetch->positions)
+                && !batch_command_writes(earlier, fetch->handle)
+                && (fetches[j].gathered || !batch_command_mentions(earlier, fetch->handle));
+        }
+        fetch->gathered = independent;
+    }
+
+    for (int k = 0; k < num_commands; k++) {
+        if (!fetches[k].gathered || context->batch_commands[k] == NULL) {
+            continue;
+        }
+        int num_members = 0;
+        for (int j = k; j < num_commands; j++) {
+            if (fetches[j].gathered && context->batch_commands[j] != NULL
+                    && strcmp(fetches[j].column, fetches[k].column) == 0) {
+                members[num_members++] = j;
+            }
+        }
+        ColumnFile* bin = open_binary_column(fetches[k].column, variable_pool);
+        if (bin == NULL) {
+            // leave them to run on their own
+            for (int m = 0; m < num_members; m++) {
+                fetches[members[m]].gathered = false;
+            }
+            continue;
+        }
+        int num_fetches = 0;
+        for (int m = 0; m < num_members; m++) {
+            BatchFetch* fetch = &fetches[members[m]];
+            CatalogEntry* pvector = get(variable_pool, fetch->positions);
+            int max_count = pvector != NULL ? pvector->size : 0;
+            int* values = malloc((max_count > 0 ? max_count : 1) * sizeof(int));
+            if (pvector == NULL || !values) {
+                perror("Error retrieving position vector");
+                free(values);
+                fetch->gathered = false;
+                continue;
+            }
+            positions[num_fetches] = pvector;
+            results[num_fetches] = values;
+            members[num_fetches++] = members[m];
+        }
+        batch_gather(bin->values, bin->count, positions, num_fetches, results, counts);
+        column_file_close(bin);
+
+        for (int f = 0; f < num_fetches; f++) {
+            BatchFetch* fetch = &fetches[members[f]];
+            CatalogEntry* cat = (CatalogEntry *) calloc(1, sizeof(CatalogEntry));
+            if (!cat) {
+                perror("Failed to allocate memory for CatalogEntry");
+                free(results[f]);
+                continue;
+            }
+            // the result holds just the values of the qualifying rows, in row order
+            strcpy(cat->name, fetch->handle);
+            strcpy(cat->filepath, fetch->column);
+            cat->bitv_capacity = (positions[f]->size > 0 ? positions[f]->size : 1) * sizeof(int);
+            cat->bitvector = results[f];
+            cat->size = counts[f];
+            cat->in_vpool = true;
+            cat->has_value = false;
+            put(variable_pool, *cat);
+            free(cat);
+            free(context->batch_commands[members[f]]);
+            context->batch_commands[members[f]] = NULL;
+        }
+    }
+    free(fetches);
+    free(positions);
+    free(results);
+    free(counts);
+    free(members);
+}
+
+/**
+ * batch_execute() runs the batch of context: the selects of the batch in
+ * one shared scan per distinct column they touch (binary searches if the
+ * column is sorted, or one walk of the column's index order if it has an
+ * index), then the fetches of
+ * their positions in one shared gather per column they read. Every other
+ * queued command is left in context->batch_commands for the caller to run
+ * in order.
+ */
+DbOperator* parse_batch_execute(char* query_command, message* send_message, CatalogEntry* variable_pool, ClientContext* context) {
+    if (strncmp(query_command, "()", 2) != 0) {
+        send_message->status = UNKNOWN_COMMAND;
+        return NULL;
     }
 
+    int num_selects = context->num_selects;
+    SelectObject** group = malloc((num_selects > 0 ? num_selects : 1) * sizeof(SelectObject*));
+    bool* planned = calloc(num_selects > 0 ? num_selects : 1, sizeof(bool));
+    if (!group || !planned) {
+        perror("Memory allocation failed");
+        free(group);
+        free(planned);
+        send_message->status = EXECUTION_ERROR;
+        return NULL;
+    }
+    bool failed = false;
+    for (int i=0; i<num_selects; i++) {
+        if (planned[i]) {
+            continue;
+        }
+        int group_size = 0;
+        for (int j=i; j<num_selects; j++) {
+            if (!planned[j] && strcmp(context->selects[j]->column, context->selects[i]->column) == 0) {
+                group[group_size++] = context->selects[j];
+                planned[j] = true;
+            }
+        }
+        char column[MAX_SIZE_NAME];
+        strcpy(column, context->selects[i]->column);
+        // a sorted column is binary searched in place; otherwise a sorted
+        // or B+tree index answers every range of the group without a scan
+        ColumnHeader header;
+        bool sorted = read_column_header(column, &header) == 0 && header.sorted;
+        IndexOrder* order = sorted ? NULL : index_order_acquire(column);
+        DbOperator* dbo;
+        if (order != NULL) {
+            dbo = batch_execute_index(order, group, group_size, (CatalogHashtable*) variable_pool);
+            index_order_release(order);
+        }
+        else if (context->multithread == false) {
+            dbo = batch_select_column(column, group, group_size, variable_pool);
+        }
+        else {
+            dbo = batch_select_column_multithread(column, group, group_size, variable_pool);
+        }
+        // the other columns' selects still run, the commands reading this
+        // group's handles fail on their own
+        if (dbo == NULL) {
+            log_err("Batched selects on %s failed\n", column);
+            failed = true;
+        }
+        free(dbo);
+    }
+    free(group);
+    free(planned);
 
+    batch_gather_fetches(context, (CatalogHashtable*) variable_pool);
+
+    if (failed) {
+        send_message->status = EXECUTION_ERROR;
+        return NULL;
+    }
     DbOperator* dbo = malloc(sizeof(DbOperator));
     return dbo;
-
 }
 
 
 
+/**
+ * True for the statuses of a command that went through.
+ */
+static bool status_ok(message_status status) {
+    return status == OK_DONE || status == OK_WAIT_FOR_RESPONSE;
+}
+
 /**
  * parse_command takes as input the send_message from the client and then
  * parses it into the appropriate query. Stores into send_message the
@@ -3770,6 +5585,14 @@ Queue* batch_queue) {
     //   Note, some commands might want to relay a different status back to the client.
     send_message->status = OK_WAIT_FOR_RESPONSE;
     query_command = trim_whitespace(query_command);
+    // inside a batch only selects on a column join its shared scans; every
+    // other command with a handle waits for batch_execute()
+    if (handle != NULL && context->is_batch && !batch_select_command(query_command)) {
+        if (batch_queue_command(handle, query_command, context) != 0) {
+            send_message->status = EXECUTION_ERROR;
+        }
+        return "";
+    }
     // check what command is given. 
     if (strncmp(query_command, "create", 6) == 0) {
         query_command += 6;
@@ -3785,7 +5608,10 @@ Queue* batch_queue) {
         dbo = parse_insert(query_command, send_message, variable_pool, context);
     } else if (handle != NULL && (strncmp(query_command, "select", 6) == 0)) {
         query_command += 6;
-        if (context->is_batch) {
+        BloomFilter* bloom = select_bloom_argument(query_command, variable_pool);
+        if (bloom != NULL) {
+            dbo = parse_select_bloom(query_command, handle, send_message, variable_pool, bloom, context->multithread);
+        } else if (context->is_batch) {
             dbo = batch_select_add(query_command, handle, send_message, variable_pool, context);
         }
         else {
@@ -3808,6 +5634,9 @@ Queue* batch_queue) {
     } else if (handle != NULL && strncmp(query_command, "sum", 3) == 0) {
         query_command += 3;
         dbo = parse_sum(query_command, handle, send_message, variable_pool); 
+    } else if (handle != NULL && strncmp(query_command, "count", 5) == 0) {
+        query_command += 5;
+        dbo = parse_count(query_command, handle, send_message, variable_pool);
     } else if (handle != NULL && strncmp(query_command, "max", 3) == 0) {
         query_command += 3;
         dbo = parse_max(query_command, handle, send_message, variable_pool); 
@@ -3816,16 +5645,35 @@ Queue* batch_queue) {
         dbo = parse_min(query_command, handle, send_message, variable_pool); 
     } else if (handle != NULL && strncmp(query_command, "add", 3) == 0) {
         query_command += 3;
-        dbo = parse_add(query_command, handle, send_message, variable_pool); 
+        dbo = parse_arithmetic(query_command, handle, send_message, variable_pool, ARITH_ADD);
     } else if (handle != NULL && strncmp(query_command, "sub", 3) == 0) {
         query_command += 3;
-        dbo = parse_sub(query_command, handle, send_message, variable_pool); 
+        dbo = parse_arithmetic(query_command, handle, send_message, variable_pool, ARITH_SUB);
+    } else if (handle != NULL && strncmp(query_command, "mul", 3) == 0) {
+        query_command += 3;
+        dbo = parse_arithmetic(query_command, handle, send_message, variable_pool, ARITH_MUL);
+    } else if (handle != NULL && strncmp(query_command, "div", 3) == 0) {
+        query_command += 3;
+        dbo = parse_arithmetic(query_command, handle, send_message, variable_pool, ARITH_DIV);
+    } else if (handle != NULL && strncmp(query_command, "groupby", 7) == 0) {
+        query_command += 7;
+        dbo = parse_group_by(query_command, handle, send_message, variable_pool, context);
+    } else if (handle != NULL && strncmp(query_command, "bloom", 5) == 0) {
+        query_command += 5;
+        dbo = parse_bloom(query_command, handle, send_message, variable_pool);
+    } else if (handle != NULL && strncmp(query_command, "join", 4) == 0) {
+        query_command += 4;
+        dbo = parse_join(query_command, handle, send_message, variable_pool);
     } else if (handle != NULL && strncmp(query_command, "shutdown", 8) == 0) {
         (void) query_command;
         return NULL;
     } else if (strncmp(query_command, "batch_queries()", 15) == 0) {
         query_command += 13;
         context->is_batch = true;
+    } else if (strncmp(query_command, "async_queries()", 15) == 0) {
+        query_command += 15;
+        context->is_batch = true;
+        context->async = true;
     } else if (strncmp(query_command, "single_core()", 13) == 0) {
         query_command += 13;
         context->multithread = false;   
@@ -3834,12 +5682,41 @@ Queue* batch_queue) {
         context->multithread = true;   
     } else if (strncmp(query_command, "batch_execute", 13) == 0) {
         query_command += 13;
-        if (context->multithread = false) {
-            dbo = parse_batch_execute(query_command, send_message, variable_pool, context);
+        dbo = parse_batch_execute(query_command, send_message, (CatalogEntry*) variable_pool, context);
+        // the batch is done; selects after it run on their own again
+        for (int i = 0; i < context->num_selects; i++) {
+            free(context->selects[i]->results);
+            free(context->selects[i]);
+        }
+        context->num_selects = 0;
+        context->is_batch = false;
+        // then the rest of the batch: independent commands at the same time
+        // in an async batch, otherwise in the order they were sent
+        // the batch reports the first error among batch_execute() and the
+        // commands run after it
+        message_status status = send_message->status;
+        message_status async_status = OK_DONE;
+        if (context->async && async_batch_run(context->batch_commands, context->num_batch_commands,
+                client_socket, context, variable_pool, batch_queue, &async_status) == 0) {
+            if (status_ok(status) && !status_ok(async_status)) {
+                status = async_status;
+            }
+        } else {
+            for (int i = 0; i < context->num_batch_commands; i++) {
+                if (context->batch_commands[i] != NULL) {
+                    parse_command(context->batch_commands[i], send_message, client_socket, context, variable_pool, batch_queue);
+                    if (status_ok(status) && !status_ok(send_message->status)) {
+                        status = send_message->status;
+                    }
+                }
+            }
         }
-        else {
-            dbo = parse_batch_execute_multithread(query_command, send_message, variable_pool, context);
+        for (int i = 0; i < context->num_batch_commands; i++) {
+            free(context->batch_commands[i]);
         }
+        context->num_batch_commands = 0;
+        context->async = false;
+        send_message->status = status;
     }
     free(dbo);
     return "";
@@ -0,0 +1,214 @@
+/**
+ * Contains all functionality for the position results of selects.
+ *
+ * A select result used to be a full length int vector with INT_MAX for rows
+ * that qualify and INT_MIN for rows that do not. It is now either a packed
+ * bitmap (one bit per row) or, when few rows qualify, an ascending list of
+ * the qualifying rows, whichever is smaller. Consumers walk either format
+ * with a PositionCursor, so work downstream of a selective select is
+ * proportional to the number of qualifying rows rather than the column.
+ **/
+
+#include <string.h>
+#include <limits.h>
+
+#include "positions.h"
+
+static int bitmap_words(int num_rows) {
+    return (num_rows + 63) / 64;
+}
+
+/**
+ * Set bits [start, end) of bitmap.
+ **/
+void bitmap_set_range(uint64_t* bitmap, int start, int end) {
+    if (start >= end) {
+        return;
+    }
+    int first = start / 64;
+    int last = (end - 1) / 64;
+    uint64_t head = ~0ULL << (start % 64);
+    uint64_t tail = ~0ULL >> (63 - (end - 1) % 64);
+    if (first == last) {
+        bitmap[first] |= head & tail;
+        return;
+    }
+    bitmap[first] |= head;
+    for (int w = first + 1; w < last; w++) {
+        bitmap[w] = ~0ULL;
+    }
+    bitmap[last] |= tail;
+}
+
+int bitmap_count(const uint64_t* bitmap, int num_rows) {
+    int count = 0;
+    int words = bitmap_words(num_rows);
+    for (int w = 0; w < words; w++) {
+        count += __builtin_popcountll(bitmap[w]);
+    }
+    return count;
+}
+
+static bool prefer_list(int count, int num_rows) {
+    return (long long) count * POSITION_LIST_RATIO < num_rows;
+}
+
+/**
+ * Make cat the position result held in bitmap (which cat takes over),
+ * converting it to a position list if it is sparse.
+ **/
+void positions_from_bitmap(CatalogEntry* cat, uint64_t* bitmap, int num_rows) {
+    int count = bitmap_count(bitmap, num_rows);
+    cat->num_rows = num_rows;
+    cat->size = count;
+    if (!prefer_list(count, num_rows)) {
+        cat->positions = POS_BITMAP;
+        cat->bitmap = bitmap;
+        cat->bitvector = NULL;
+        cat->bitv_capacity = 0;
+        return;
+    }
+
+    int* list = malloc((count > 0 ? count : 1) * sizeof(int));
+    if (!list) {
+        perror("Memory allocation failed");
+        cat->positions = POS_BITMAP;
+        cat->bitmap = bitmap;
+        cat->bitvector = NULL;
+        cat->bitv_capacity = 0;
+        return;
+    }
+    int n = 0;
+    int words = bitmap_words(num_rows);
+    for (int w = 0; w < words; w++) {
+        uint64_t bits = bitmap[w];
+        while (bits) {
+            list[n++] = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+    }
+    free(bitmap);
+    cat->positions = POS_LIST;
+    cat->bitmap = NULL;
+    cat->bitvector = list;
+    cat->bitv_capacity = (count > 0 ? count : 1) * sizeof(int);
+}
+
+/**
+ * Make cat the position result held in list (taken over by cat), converting
+ * it to a bitmap if it is dense. Only a strictly ascending list can become a
+ * bitmap: rows from a join may repeat or be out of order, and a bitmap
+ * would merge and sort them.
+ **/
+void positions_from_list(CatalogEntry* cat, int* list, int count, int num_rows) {
+    cat->num_rows = num_rows;
+    cat->size = count;
+    bool ascending = true;
+    for (int i = 1; i < count && ascending; i++) {
+        ascending = list[i] > list[i - 1];
+    }
+    if (!ascending || prefer_list(count, num_rows)) {
+        cat->positions = POS_LIST;
+        cat->bitmap = NULL;
+        cat->bitvector = list;
+        cat->bitv_capacity = (count > 0 ? count : 1) * sizeof(int);
+        return;
+    }
+
+    uint64_t* bitmap = calloc(bitmap_words(num_rows) > 0 ? bitmap_words(num_rows) : 1, sizeof(uint64_t));
+    if (!bitmap) {
+        perror("Memory allocation failed");
+        cat->positions = POS_LIST;
+        cat->bitmap = NULL;
+        cat->bitvector = list;
+        cat->bitv_capacity = (count > 0 ? count : 1) * sizeof(int);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        bitmap[list[i] / 64] |= 1ULL << (list[i] % 64);
+    }
+    free(list);
+    cat->positions = POS_BITMAP;
+    cat->bitmap = bitmap;
+    cat->bitvector = NULL;
+    cat->bitv_capacity = 0;
+}
+
+/**
+ * Convert a result still built the old way (cat->size ints in cat->bitvector,
+ * INT_MIN for rows that do not qualify) into a position result.
+ **/
+void positions_from_markers(CatalogEntry* cat) {
+    int num_rows = cat->size;
+    uint64_t* bitmap = calloc(bitmap_words(num_rows) > 0 ? bitmap_words(num_rows) : 1, sizeof(uint64_t));
+    if (!bitmap) {
+        perror("Memory allocation failed");
+        return;
+    }
+    for (int i = 0; i < num_rows; i++) {
+        if (cat->bitvector[i] != INT_MIN) {
+            bitmap[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+    free(cat->bitvector);
+    cat->bitvector = NULL;
+    positions_from_bitmap(cat, bitmap, num_rows);
+}
+
+/**
+ * Make cat the result of one side of a join: list (taken over by cat) holds
+ * the rows in match order, possibly repeated, so it is always kept as a list.
+ **/
+void positions_from_join(CatalogEntry* cat, int* list, int count, int num_rows) {
+    cat->num_rows = num_rows;
+    cat->size = count;
+    cat->positions = POS_LIST;
+    cat->bitmap = NULL;
+    cat->bitvector = list;
+    cat->bitv_capacity = (count > 0 ? count : 1) * sizeof(int);
+}
+
+bool is_position_result(const CatalogEntry* cat) {
+    return cat != NULL && cat->positions != POS_NONE;
+}
+
+void position_cursor_init(PositionCursor* cursor, const CatalogEntry* cat) {
+    cursor->entry = cat;
+    cursor->index = 0;
+    cursor->bits = 0;
+    cursor->base = 0;
+}
+
+/**
+ * Next qualifying row, or -1 once every row has been returned.
+ * Entries that are not position results are read the old way: every
+ * row whose value is not INT_MIN qualifies.
+ **/
+int position_cursor_next(PositionCursor* cursor) {
+    const CatalogEntry* cat = cursor->entry;
+    switch (cat->positions) {
+        case POS_LIST:
+            return cursor->index < cat->size ? cat->bitvector[cursor->index++] : -1;
+        case POS_BITMAP: {
+            int words = bitmap_words(cat->num_rows);
+            while (cursor->bits == 0) {
+                if (cursor->index >= words) {
+                    return -1;
+                }
+                cursor->base = cursor->index * 64;
+                cursor->bits = cat->bitmap[cursor->index++];
+            }
+            int pos = cursor->base + __builtin_ctzll(cursor->bits);
+            cursor->bits &= cursor->bits - 1;
+            return pos;
+        }
+        default:
+            while (cursor->index < cat->size) {
+                int i = cursor->index++;
+                if (cat->bitvector[i] != INT_MIN) {
+                    return i;
+                }
+            }
+            return -1;
+    }
+}
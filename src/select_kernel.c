@@ -0,0 +1,170 @@
+/**
+ * Contains the vectorized range-select kernels.
+ *
+ * Evaluates lo <= v < hi over a packed int32 column without branching on the
+ * data: each lane is compared against both bounds, the comparison masks are
+ * packed into a bitmap word with movemask, and selection vectors are built
+ * from the bitmap by always writing the candidate position and advancing the
+ * output cursor by the bit. The widest kernel the CPU supports (AVX2, SSE2 or
+ * plain C) is picked once through CPUID, so the server binary itself does not
+ * need to be built for a particular instruction set.
+ **/
+
+#include <string.h>
+
+#include "select_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SELECT_KERNEL_X86 1
+#endif
+
+// values handled per bitmap buffer when building selection vectors
+#define POSITION_CHUNK 4096
+
+typedef size_t (*BitmapKernel)(const int* values, size_t n, int lo, int hi, uint64_t* bitmap);
+
+static BitmapKernel bitmap_kernel = NULL;
+static const char* kernel_name = "scalar";
+
+
+/**
+ * Bitmap word for len (<= 64) values, one bit per value.
+ **/
+static uint64_t word_scalar(const int* values, size_t len, int lo, int hi) {
+    uint64_t word = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint64_t hit = (uint64_t) ((values[i] >= lo) & (values[i] < hi));
+        word |= hit << i;
+    }
+    return word;
+}
+
+static size_t bitmap_scalar(const int* values, size_t n, int lo, int hi, uint64_t* bitmap) {
+    size_t count = 0;
+    for (size_t w = 0; w * 64 < n; w++) {
+        size_t len = n - w * 64 < 64 ? n - w * 64 : 64;
+        bitmap[w] = word_scalar(values + w * 64, len, lo, hi);
+        count += __builtin_popcountll(bitmap[w]);
+    }
+    return count;
+}
+
+#ifdef SELECT_KERNEL_X86
+
+__attribute__((target("sse2")))
+static size_t bitmap_sse2(const int* values, size_t n, int lo, int hi, uint64_t* bitmap) {
+    __m128i vlo = _mm_set1_epi32(lo);
+    __m128i vhi = _mm_set1_epi32(hi);
+    size_t full = n / 64;
+    size_t count = 0;
+    for (size_t w = 0; w < full; w++) {
+        const int* p = values + w * 64;
+        uint64_t word = 0;
+        for (int j = 0; j < 16; j++) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (p + j * 4));
+            // v >= lo is !(lo > v); v < hi is hi > v
+            __m128i m = _mm_andnot_si128(_mm_cmpgt_epi32(vlo, v), _mm_cmpgt_epi32(vhi, v));
+            word |= (uint64_t) (unsigned) _mm_movemask_ps(_mm_castsi128_ps(m)) << (j * 4);
+        }
+        bitmap[w] = word;
+        count += __builtin_popcountll(word);
+    }
+    if (n % 64) {
+        bitmap[full] = word_scalar(values + full * 64, n % 64, lo, hi);
+        count += __builtin_popcountll(bitmap[full]);
+    }
+    return count;
+}
+
+__attribute__((target("avx2")))
+static size_t bitmap_avx2(const int* values, size_t n, int lo, int hi, uint64_t* bitmap) {
+    __m256i vlo = _mm256_set1_epi32(lo);
+    __m256i vhi = _mm256_set1_epi32(hi);
+    size_t full = n / 64;
+    size_t count = 0;
+    for (size_t w = 0; w < full; w++) {
+        const int* p = values + w * 64;
+        uint64_t word = 0;
+        for (int j = 0; j < 8; j++) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) (p + j * 8));
+            __m256i m = _mm256_andnot_si256(_mm256_cmpgt_epi32(vlo, v), _mm256_cmpgt_epi32(vhi, v));
+            word |= (uint64_t) (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(m)) << (j * 8);
+        }
+        bitmap[w] = word;
+        count += __builtin_popcountll(word);
+    }
+    if (n % 64) {
+        bitmap[full] = word_scalar(values + full * 64, n % 64, lo, hi);
+        count += __builtin_popcountll(bitmap[full]);
+    }
+    return count;
+}
+
+#endif
+
+/**
+ * Pick the widest kernel this CPU supports. Racing threads all pick the
+ * same one, so no locking is needed.
+ **/
+static void choose_kernel(void) {
+    BitmapKernel kernel = bitmap_scalar;
+    const char* name = "scalar";
+#ifdef SELECT_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = bitmap_avx2;
+        name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel = bitmap_sse2;
+        name = "sse2";
+    }
+#endif
+    kernel_name = name;
+    bitmap_kernel = kernel;
+}
+
+/**
+ * Name of the kernel in use ("avx2", "sse2" or "scalar").
+ **/
+const char* select_kernel_name(void) {
+    if (bitmap_kernel == NULL) {
+        choose_kernel();
+    }
+    return kernel_name;
+}
+
+/**
+ * Sets bit i of bitmap (ceil(n / 64) words) iff lo <= values[i] < hi, with
+ * the unused bits of the last word cleared. Returns the number of bits set.
+ **/
+size_t select_range_bitmap(const int* values, size_t n, int lo, int hi, uint64_t* bitmap) {
+    if (bitmap_kernel == NULL) {
+        choose_kernel();
+    }
+    return bitmap_kernel(values, n, lo, hi, bitmap);
+}
+
+/**
+ * Writes base + i for every i with lo <= values[i] < hi, in ascending order,
+ * to positions (room for n entries). Returns the number written.
+ **/
+size_t select_range_positions(const int* values, size_t n, int lo, int hi, int base, int* positions) {
+    uint64_t bitmap[POSITION_CHUNK / 64];
+    size_t count = 0;
+    for (size_t start = 0; start < n; start += POSITION_CHUNK) {
+        size_t len = n - start < POSITION_CHUNK ? n - start : POSITION_CHUNK;
+        select_range_bitmap(values + start, len, lo, hi, bitmap);
+        for (size_t w = 0; w * 64 < len; w++) {
+            uint64_t word = bitmap[w];
+            size_t bits = len - w * 64 < 64 ? len - w * 64 : 64;
+            int pos = base + (int) (start + w * 64);
+            // always store, only advance past the stored slot on a hit
+            for (size_t b = 0; b < bits; b++) {
+                positions[count] = pos + (int) b;
+                count += (word >> b) & 1;
+            }
+        }
+    }
+    return count;
+}
@@ -28,6 +28,8 @@
 #include "message.h"
 #include "utils.h"
 #include "client_context.h"
+#include "thread_pool.h"
+#include "select_kernel.h"
 #include <pthread.h>
 
 
@@ -66,6 +68,8 @@ void handle_client(void* client_socket_arg) {
     client_context->is_batch = false;
     client_context->multithread = true;
     client_context->num_selects = 0;
+    client_context->num_batch_commands = 0;
+    client_context->async = false;
     client_context->num_tables=0;
 
     //client_context->db_set = false;
@@ -105,6 +109,7 @@ void handle_client(void* client_socket_arg) {
             if (strncmp(recv_message.payload, "shutdown", 8) == 0) {
                 log_info("-- Shutting down!\n");
                 deallocate(variable_pool);
+                index_orders_clear();
                 client_context = NULL;
                 shutdown = true;
                 done = 1;
@@ -116,6 +121,9 @@ void handle_client(void* client_socket_arg) {
     
             char* result = parse_command(recv_message.payload, &send_message, client_socket, 
                                                 client_context, variable_pool, batch_queue);
+            if (client_context != NULL) {
+                release_retired(variable_pool);
+            }
 
             // 2. Handle request
 
@@ -220,6 +228,13 @@ int main(void) {
         exit(1);
     }
 
+    // one worker per core, shared by every client's parallel queries
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_pool_init(num_cpus > 0 ? (int) num_cpus : 1) == -1) {
+        log_err("Failed to start worker threads, running queries serially.\n");
+    }
+    log_info("Using %s range select kernel.\n", select_kernel_name());
+
     log_info("Waiting for a connection %d ...\n", server_socket);
 
     while(1) {
@@ -240,6 +255,7 @@ int main(void) {
         }
     }
 
+    thread_pool_destroy();
     close(server_socket);
     return 0;
 }
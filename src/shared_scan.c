@@ -0,0 +1,261 @@
+/**
+ * Contains all functionality for scans shared between concurrent selects.
+ *
+ * Every client runs its selects on its own thread, so clients that select
+ * on the same column at the same time would each scan it in full. Instead
+ * the server keeps one circular scan per column. The first select on a
+ * column starts it and drives it: the scan moves through the column a chunk
+ * at a time and evaluates, on the chunk, the predicate of every select
+ * attached to it, each into that select's own bitmap. A select on the same
+ * column that arrives in the meantime attaches to the running scan and sees
+ * the chunks from the next one on; once the scan reaches the end of the
+ * column it wraps around to the start, until every attached select has seen
+ * every chunk once. The chunk is read from memory once and stays in cache
+ * for the other predicates. Selects only wait for the scan they ride on.
+ * The select driving the scan hands it to one of the others once it has
+ * seen every chunk itself, so that a stream of new selects cannot keep it
+ * driving, and the scan ends when its last select is done.
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "shared_scan.h"
+#include "bloom.h"
+#include "column_file.h"
+#include "parse.h"
+#include "utils.h"
+
+/**
+ * ScanRider
+ * One select attached to a shared scan. chunks_left counts the chunks it
+ * has yet to see; it is done when that reaches 0.
+ **/
+typedef struct ScanRider {
+    const SelectOperator* select;
+    int num_rows;
+    uint64_t* bitmap;
+    int chunks_left;
+    struct ScanRider* next;
+} ScanRider;
+
+/**
+ * SharedScan
+ * A running scan of one column. next_chunk is the chunk it scans next,
+ * riders the selects attached to it. needs_driver is set when the select
+ * driving it is done while others are not, for one of them to take over.
+ **/
+typedef struct SharedScan {
+    char column[MAX_SIZE_NAME];
+    ColumnFile* cf;
+    int num_rows;
+    int num_chunks;
+    int next_chunk;
+    ScanRider* riders;
+    bool needs_driver;
+    pthread_cond_t done;
+    struct SharedScan* next;
+} SharedScan;
+
+/**
+ * ChunkJob
+ * One chunk of a shared scan on the thread pool, for the riders that were
+ * attached when it started.
+ **/
+typedef struct ChunkJob {
+    ColumnFile* cf;
+    ScanRider** riders;
+    int num_riders;
+} ChunkJob;
+
+static pthread_mutex_t scans_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SharedScan* active_scans = NULL;
+
+
+static SharedScan* find_scan(const char* column) {
+    for (SharedScan* scan = active_scans; scan != NULL; scan = scan->next) {
+        if (strcmp(scan->column, column) == 0) {
+            return scan;
+        }
+    }
+    return NULL;
+}
+
+static void remove_scan(SharedScan* scan) {
+    for (SharedScan** link = &active_scans; *link != NULL; link = &(*link)->next) {
+        if (*link == scan) {
+            *link = scan->next;
+            return;
+        }
+    }
+}
+
+/**
+ * Evaluates every rider's select over rows [start, end). Morsels start on
+ * multiples of 64, so each fills whole words of the riders' bitmaps.
+ **/
+static void scan_morsel(void* arg, int start, int end) {
+    ChunkJob* job = (ChunkJob*) arg;
+    for (int r = 0; r < job->num_riders; r++) {
+        ScanRider* rider = job->riders[r];
+        const SelectOperator* select = rider->select;
+        int rider_end = end < rider->num_rows ? end : rider->num_rows;
+        if (start >= rider_end) {
+            continue;
+        }
+        uint64_t* bitmap = rider->bitmap + start / 64;
+        select_binary_range(job->cf, select->low, select->high, bitmap, start, rider_end);
+        if (select->bloom != NULL) {
+            bloom_filter_bitmap(select->bloom, job->cf->values + start, rider_end - start, bitmap);
+        }
+    }
+}
+
+/**
+ * Runs scan until own, the select of the calling thread, has seen every
+ * chunk. If other riders are left, one of them takes the scan over;
+ * otherwise it is removed and freed. Called with scans_mutex held, which
+ * it releases.
+ **/
+static void drive_scan(SharedScan* scan, ScanRider* own) {
+    ScanRider** riders = NULL;
+    int capacity = 0;
+    while (own->chunks_left > 0 && scan->riders != NULL) {
+        // the riders attached now are the ones that see this chunk
+        int num_riders = 0;
+        bool parallel = false;
+        for (ScanRider* rider = scan->riders; rider != NULL; rider = rider->next) {
+            num_riders++;
+        }
+        if (num_riders > capacity) {
+            ScanRider** copy = realloc(riders, num_riders * sizeof(ScanRider*));
+            if (!copy) {
+                // riders keep waiting for a scan that cannot go on; fail them all
+                perror("Memory allocation failed");
+                for (ScanRider* rider = scan->riders; rider != NULL; rider = rider->next) {
+                    rider->chunks_left = -1;
+                }
+                scan->riders = NULL;
+                break;
+            }
+            riders = copy;
+            capacity = num_riders;
+        }
+        num_riders = 0;
+        for (ScanRider* rider = scan->riders; rider != NULL; rider = rider->next) {
+            riders[num_riders++] = rider;
+            parallel = parallel || rider->select->parallel;
+        }
+        int chunk = scan->next_chunk;
+        pthread_mutex_unlock(&scans_mutex);
+
+        int start = chunk * SHARED_SCAN_CHUNK;
+        int end = start + SHARED_SCAN_CHUNK < scan->num_rows ? start + SHARED_SCAN_CHUNK : scan->num_rows;
+        ChunkJob job = { scan->cf, riders, num_riders };
+        if (parallel) {
+            thread_pool_run(scan_morsel, &job, start, end, MORSEL_SIZE);
+        } else {
+            scan_morsel(&job, start, end);
+        }
+
+        pthread_mutex_lock(&scans_mutex);
+        scan->next_chunk = (chunk + 1) % scan->num_chunks;
+        ScanRider** link = &scan->riders;
+        while (*link != NULL) {
+            ScanRider* rider = *link;
+            bool saw_chunk = false;
+            for (int r = 0; r < num_riders && !saw_chunk; r++) {
+                saw_chunk = riders[r] == rider;
+            }
+            if (saw_chunk && --rider->chunks_left == 0) {
+                *link = rider->next;
+            } else {
+                link = &rider->next;
+            }
+        }
+        pthread_cond_broadcast(&scan->done);
+    }
+    free(riders);
+    if (scan->riders != NULL) {
+        // the waiting riders are woken by the broadcast above
+        scan->needs_driver = true;
+        pthread_mutex_unlock(&scans_mutex);
+        return;
+    }
+    // the scan cannot be found any more, so no select attaches after this
+    remove_scan(scan);
+    pthread_cond_broadcast(&scan->done);
+    pthread_mutex_unlock(&scans_mutex);
+
+    column_file_close(scan->cf);
+    pthread_cond_destroy(&scan->done);
+    free(scan);
+}
+
+/**
+ * Sets the bits of bitmap (room for select->num_rows rows) of the rows that
+ * qualify for select, scanning its column together with the other selects
+ * on it that run at the same time. Returns the number of rows covered
+ * (those present when the select was issued and still in the column), or
+ * -1 on error.
+ **/
+int shared_scan_select(const SelectOperator* select, uint64_t* bitmap) {
+    ScanRider rider;
+    rider.select = select;
+    rider.bitmap = bitmap;
+    rider.next = NULL;
+
+    pthread_mutex_lock(&scans_mutex);
+    SharedScan* scan = find_scan(select->column);
+    if (scan != NULL && select->num_rows <= scan->num_rows) {
+        rider.num_rows = select->num_rows;
+        rider.chunks_left = scan->num_chunks;
+        rider.next = scan->riders;
+        scan->riders = &rider;
+        while (rider.chunks_left > 0) {
+            if (scan->needs_driver) {
+                scan->needs_driver = false;
+                drive_scan(scan, &rider);
+                return rider.chunks_left == 0 ? rider.num_rows : -1;
+            }
+            pthread_cond_wait(&scan->done, &scans_mutex);
+        }
+        pthread_mutex_unlock(&scans_mutex);
+        return rider.chunks_left == 0 ? rider.num_rows : -1;
+    }
+    pthread_mutex_unlock(&scans_mutex);
+
+    SharedScan* own = calloc(1, sizeof(SharedScan));
+    ColumnFile* cf = open_binary_column((char*) select->column, NULL);
+    if (!own || !cf) {
+        perror("Error opening column");
+        free(own);
+        column_file_close(cf);
+        return -1;
+    }
+    strcpy(own->column, select->column);
+    own->cf = cf;
+    own->num_rows = (int) cf->count;
+    own->num_chunks = (own->num_rows + SHARED_SCAN_CHUNK - 1) / SHARED_SCAN_CHUNK;
+    pthread_cond_init(&own->done, NULL);
+    rider.num_rows = select->num_rows < own->num_rows ? select->num_rows : own->num_rows;
+    rider.chunks_left = own->num_chunks;
+    if (own->num_chunks == 0) {
+        column_file_close(cf);
+        pthread_cond_destroy(&own->done);
+        free(own);
+        return 0;
+    }
+    own->riders = &rider;
+
+    pthread_mutex_lock(&scans_mutex);
+    // a scan of the column that started meanwhile does not get company;
+    // this one runs on its own
+    if (find_scan(select->column) == NULL) {
+        own->next = active_scans;
+        active_scans = own;
+    }
+    drive_scan(own, &rider);
+    return rider.chunks_left == 0 ? rider.num_rows : -1;
+}
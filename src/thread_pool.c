@@ -0,0 +1,361 @@
+/**
+ * Contains all functionality for the worker thread pool.
+ *
+ * The server starts one pool at startup instead of creating threads for every
+ * query. A parallel operation is submitted as a MorselJob covering a row range
+ * that is cut into morsel_size row morsels. The morsels are dealt out in
+ * contiguous runs to every worker's queue; a worker works through its own
+ * queue from the tail and, once it is empty, steals from the head of the
+ * other queues. That way a worker stuck on an expensive morsel (an index probe,
+ * long text lines) does not hold up the rest of its share. The submitting
+ * thread steals too, so a job always makes progress even when every worker is
+ * busy with other clients. It only takes morsels of its own job, so a thread
+ * never ends up waiting on work it is itself in the middle of.
+ **/
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "thread_pool.h"
+#include "utils.h"
+
+static ThreadPool* worker_pool = NULL;
+
+
+void queue_init(Queue* queue) {
+    queue->head = NULL;
+    queue->tail = NULL;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+}
+
+void queue_push_tail(Queue* queue, node_t* node) {
+    pthread_mutex_lock(&queue->mutex);
+    node->next = NULL;
+    node->prev = queue->tail;
+    if (queue->tail) {
+        queue->tail->next = node;
+    } else {
+        queue->head = node;
+    }
+    queue->tail = node;
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/**
+ * Take the most recently pushed node (used by the queue's owner).
+ **/
+node_t* queue_pop_tail(Queue* queue) {
+    pthread_mutex_lock(&queue->mutex);
+    node_t* node = queue->tail;
+    if (node) {
+        queue->tail = node->prev;
+        if (queue->tail) {
+            queue->tail->next = NULL;
+        } else {
+            queue->head = NULL;
+        }
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return node;
+}
+
+/**
+ * Take the oldest node (used by threads stealing from another queue).
+ **/
+node_t* queue_steal_head(Queue* queue) {
+    pthread_mutex_lock(&queue->mutex);
+    node_t* node = queue->head;
+    if (node) {
+        queue->head = node->next;
+        if (queue->head) {
+            queue->head->prev = NULL;
+        } else {
+            queue->tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return node;
+}
+
+/**
+ * Take the oldest node of job (used by a job's submitter).
+ **/
+node_t* queue_steal_job(Queue* queue, const MorselJob* job) {
+    pthread_mutex_lock(&queue->mutex);
+    node_t* node = queue->head;
+    while (node && node->job != job) {
+        node = node->next;
+    }
+    if (node) {
+        if (node->prev) {
+            node->prev->next = node->next;
+        } else {
+            queue->head = node->next;
+        }
+        if (node->next) {
+            node->next->prev = node->prev;
+        } else {
+            queue->tail = node->prev;
+        }
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return node;
+}
+
+/**
+ * Find a morsel to run: the tail of queue self (if self >= 0), otherwise
+ * the head of the first non-empty queue after it.
+ **/
+static node_t* find_morsel(ThreadPool* pool, int self) {
+    node_t* node = NULL;
+    if (self >= 0) {
+        node = queue_pop_tail(&pool->queues[self]);
+    }
+    for (int i = 1; node == NULL && i <= pool->num_threads; i++) {
+        int victim = (self + i + pool->num_threads) % pool->num_threads;
+        if (victim == self) {
+            continue;
+        }
+        node = queue_steal_head(&pool->queues[victim]);
+    }
+    if (node) {
+        __sync_fetch_and_sub(&pool->queued, 1);
+    }
+    return node;
+}
+
+/**
+ * Find a morsel of job in any queue.
+ **/
+static node_t* find_job_morsel(ThreadPool* pool, const MorselJob* job) {
+    node_t* node = NULL;
+    for (int i = 0; node == NULL && i < pool->num_threads; i++) {
+        node = queue_steal_job(&pool->queues[i], job);
+    }
+    if (node) {
+        __sync_fetch_and_sub(&pool->queued, 1);
+    }
+    return node;
+}
+
+/**
+ * Run one morsel and wake its submitter if it was the job's last.
+ **/
+static void run_morsel(node_t* node) {
+    MorselJob* job = node->job;
+    job->func(job->arg, node->start, node->end);
+    // the submitter frees job as soon as it sees remaining hit 0 under the
+    // mutex, so the job must not be touched after unlocking
+    pthread_mutex_lock(&job->mutex);
+    job->remaining--;
+    if (job->remaining == 0) {
+        pthread_cond_signal(&job->done);
+    }
+    pthread_mutex_unlock(&job->mutex);
+}
+
+static void* worker(void* arg) {
+    ThreadPool* pool = (ThreadPool*) arg;
+    int self = __sync_fetch_and_add(&pool->next_id, 1);
+    while (true) {
+        node_t* node = find_morsel(pool, self);
+        if (node) {
+            run_morsel(node);
+            continue;
+        }
+        pthread_mutex_lock(&pool->mutex);
+        while (!pool->shutdown && pool->queued == 0) {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        }
+        bool stop = pool->shutdown;
+        pthread_mutex_unlock(&pool->mutex);
+        if (stop) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Start num_threads workers. Called once from main().
+ **/
+int thread_pool_init(int num_threads) {
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+    if (!pool) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    pool->threads = malloc(num_threads * sizeof(pthread_t));
+    pool->queues = malloc(num_threads * sizeof(Queue));
+    if (!pool->threads || !pool->queues) {
+        perror("Memory allocation failed");
+        free(pool->threads);
+        free(pool->queues);
+        free(pool);
+        return -1;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    for (int i = 0; i < num_threads; i++) {
+        queue_init(&pool->queues[i]);
+    }
+
+    // num_threads must be final before any worker starts indexing queues
+    pool->num_threads = num_threads;
+    int started = 0;
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker, pool)) {
+            perror("Failed to create worker thread");
+            break;
+        }
+        started++;
+    }
+    if (started < num_threads) {
+        // the queues of workers that never started would not be drained
+        pthread_mutex_lock(&pool->mutex);
+        pool->shutdown = true;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->mutex);
+        for (int i = 0; i < started; i++) {
+            pthread_join(pool->threads[i], NULL);
+        }
+        free(pool->threads);
+        free(pool->queues);
+        free(pool);
+        return -1;
+    }
+    log_info("Started %d worker threads.\n", pool->num_threads);
+    worker_pool = pool;
+    return 0;
+}
+
+void thread_pool_destroy(void) {
+    ThreadPool* pool = worker_pool;
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    for (int i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    worker_pool = NULL;
+    for (int i = 0; i < pool->num_threads; i++) {
+        pthread_mutex_destroy(&pool->queues[i].mutex);
+        pthread_cond_destroy(&pool->queues[i].cond);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->cond);
+    free(pool->threads);
+    free(pool->queues);
+    free(pool);
+}
+
+/**
+ * Number of threads that can work on a job at once (workers plus the caller).
+ **/
+int thread_pool_size(void) {
+    return worker_pool ? worker_pool->num_threads + 1 : 1;
+}
+
+/**
+ * Run func over [start, end) in morsels of morsel_size rows and return once
+ * every morsel has finished. Morsels of one job may run concurrently, so func
+ * must only write state owned by its own rows.
+ *
+ * func may call thread_pool_run itself (an async batch runs each command as
+ * a morsel, and the command's join or scan runs its own job). That cannot
+ * deadlock: the caller only ever runs morsels of its own job, and a worker
+ * blocked in a nested call waits for morsels that are either still queued,
+ * which it runs itself, or already taken by a thread that finishes them.
+ * Such a worker is lost to the pool until its job is done, so the jobs of a
+ * wave share fewer free workers.
+ **/
+void thread_pool_run(MorselFunction func, void* arg, int start, int end, int morsel_size) {
+    if (start >= end) {
+        return;
+    }
+    if (morsel_size < 1) {
+        morsel_size = MORSEL_SIZE;
+    }
+    int num_morsels = (end - start + morsel_size - 1) / morsel_size;
+
+    ThreadPool* pool = worker_pool;
+    if (pool == NULL || num_morsels == 1) {
+        // nothing to share: run on the calling thread
+        for (int s = start; s < end; s += morsel_size) {
+            func(arg, s, s + morsel_size < end ? s + morsel_size : end);
+        }
+        return;
+    }
+
+    MorselJob job;
+    job.func = func;
+    job.arg = arg;
+    job.remaining = num_morsels;
+    job.nodes = malloc(num_morsels * sizeof(node_t));
+    if (!job.nodes) {
+        perror("Memory allocation failed");
+        for (int s = start; s < end; s += morsel_size) {
+            func(arg, s, s + morsel_size < end ? s + morsel_size : end);
+        }
+        return;
+    }
+    pthread_mutex_init(&job.mutex, NULL);
+    pthread_cond_init(&job.done, NULL);
+
+    // deal the morsels out in contiguous runs so each worker scans
+    // neighbouring rows until it has to steal
+    for (int i = 0; i < num_morsels; i++) {
+        node_t* node = &job.nodes[i];
+        node->job = &job;
+        node->start = start + i * morsel_size;
+        node->end = node->start + morsel_size < end ? node->start + morsel_size : end;
+    }
+    // count the morsels before they become visible so queued never drops below 0
+    __sync_fetch_and_add(&pool->queued, num_morsels);
+    for (int w = 0; w < pool->num_threads; w++) {
+        int first = (int) ((long long) num_morsels * w / pool->num_threads);
+        int last = (int) ((long long) num_morsels * (w + 1) / pool->num_threads);
+        // pushed back to front so the owner pops them in row order
+        for (int i = last - 1; i >= first; i--) {
+            queue_push_tail(&pool->queues[w], &job.nodes[i]);
+        }
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    // help out rather than sleeping, but only with our own morsels: another
+    // job's morsel may be a whole command (an async batch runs one per
+    // morsel) that waits on what this thread is in the middle of, such as
+    // the shared scan it drives
+    while (true) {
+        pthread_mutex_lock(&job.mutex);
+        bool finished = job.remaining == 0;
+        pthread_mutex_unlock(&job.mutex);
+        if (finished) {
+            break;
+        }
+        node_t* node = find_job_morsel(pool, &job);
+        if (node == NULL) {
+            break;
+        }
+        run_morsel(node);
+    }
+
+    pthread_mutex_lock(&job.mutex);
+    while (job.remaining > 0) {
+        pthread_cond_wait(&job.done, &job.mutex);
+    }
+    pthread_mutex_unlock(&job.mutex);
+    pthread_cond_destroy(&job.done);
+    pthread_mutex_destroy(&job.mutex);
+    free(job.nodes);
+}